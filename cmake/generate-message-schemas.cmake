@@ -0,0 +1,88 @@
+# Copyright (C) 2020 Ola Benderius
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Generates the constexpr field tables of the messages in .odvd files:
+#
+#   cmake -DTEMPLATE=<hpp.in> -DOUT=<hpp> -P generate-message-schemas.cmake 
+#     <odvd>...
+
+set(ODVD_FILES)
+set(isScriptFound FALSE)
+math(EXPR lastArg "${CMAKE_ARGC} - 1")
+foreach(i RANGE ${lastArg})
+  if(isScriptFound)
+    list(APPEND ODVD_FILES "${CMAKE_ARGV${i}}")
+  elseif("${CMAKE_ARGV${i}}" MATCHES "generate-message-schemas.cmake$")
+    set(isScriptFound TRUE)
+  endif()
+endforeach()
+
+set(FIELD_TYPES_bool Bool)
+set(FIELD_TYPES_char Char)
+set(FIELD_TYPES_int8 Int8)
+set(FIELD_TYPES_uint8 Uint8)
+set(FIELD_TYPES_int16 Int16)
+set(FIELD_TYPES_uint16 Uint16)
+set(FIELD_TYPES_int32 Int32)
+set(FIELD_TYPES_uint32 Uint32)
+set(FIELD_TYPES_int64 Int64)
+set(FIELD_TYPES_uint64 Uint64)
+set(FIELD_TYPES_float Float)
+set(FIELD_TYPES_double Double)
+set(FIELD_TYPES_string String)
+set(FIELD_TYPES_bytes Bytes)
+
+set(ODVD_NAMES)
+set(MESSAGE_FIELDS)
+set(MESSAGE_SCHEMAS)
+set(fieldCount 0)
+foreach(odvd ${ODVD_FILES})
+  get_filename_component(odvdName "${odvd}" NAME)
+  list(APPEND ODVD_NAMES "${odvdName}")
+
+  # One list item per line. Semicolons only end the field declarations.
+  file(READ "${odvd}" content)
+  string(REPLACE ";" "" content "${content}")
+  string(REPLACE "\n" ";" lines "${content}")
+
+  set(messageName)
+  foreach(line ${lines})
+    if(line MATCHES "^[ \t]*message[ \t]+([A-Za-z0-9_.]+)[ \t]*\\[.*id[ \t]*=[ \t]*([0-9]+)")
+      set(messageName ${CMAKE_MATCH_1})
+      set(messageId ${CMAKE_MATCH_2})
+      set(firstField ${fieldCount})
+    elseif(messageName AND line MATCHES "^[ \t]*([A-Za-z0-9_.]+)[ \t]+[A-Za-z0-9_]+[ \t]*\\[.*id[ \t]*=[ \t]*([0-9]+)")
+      set(fieldType Message)
+      if(DEFINED FIELD_TYPES_${CMAKE_MATCH_1})
+        set(fieldType ${FIELD_TYPES_${CMAKE_MATCH_1}})
+      endif()
+      string(APPEND MESSAGE_FIELDS 
+        "  MessageField{${CMAKE_MATCH_2}, FieldType::${fieldType}},\n")
+      math(EXPR fieldCount "${fieldCount} + 1")
+    elseif(messageName AND line MATCHES "^[ \t]*}")
+      math(EXPR messageFieldCount "${fieldCount} - ${firstField}")
+      string(APPEND MESSAGE_SCHEMAS "  MessageSchema{${messageId}, "
+        "\"${messageName}\", ${firstField}, ${messageFieldCount}},\n")
+      set(messageName)
+    endif()
+  endforeach()
+endforeach()
+
+if(fieldCount EQUAL 0)
+  # Arrays cannot be empty.
+  set(MESSAGE_FIELDS "  MessageField{0, FieldType::Message},\n")
+endif()
+string(REPLACE ";" ", " ODVD_NAMES "${ODVD_NAMES}")
+configure_file("${TEMPLATE}" "${OUT}" @ONLY)
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "analysis-cache.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace {
+
+constexpr char CACHE_HEADER[]{"peak-reencode analysis cache 1"};
+constexpr uint64_t HASHED_SIZE{64 * 1024};
+constexpr size_t FIELD_COUNT{15};
+
+// FNV-1a over the given bytes, continuing from hash.
+uint64_t hashBytes(uint64_t hash, char const *data, uint64_t size) noexcept
+{
+  for (uint64_t i{0}; i < size; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// In nanoseconds, or zero if the file cannot be found.
+int64_t modifiedTime(std::string const &filename) noexcept
+{
+  struct stat st;
+  if (::stat(filename.c_str(), &st) != 0) {
+    return 0;
+  }
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000 * 1000 * 1000 
+    + st.st_mtim.tv_nsec;
+}
+
+}
+
+RecFileKey recFileKey(std::string const &filename, RecFileView const &view)
+{
+  return RecFileKey{std::filesystem::absolute(filename).lexically_normal()
+    .string(), view.size(), modifiedTime(filename), sampledContentHash(view)};
+}
+
+// Hash of the first and last 64 KiB of a file.
+uint64_t sampledContentHash(RecFileView const &view) noexcept
+{
+  uint64_t const headSize{std::min(view.size(), HASHED_SIZE)};
+  uint64_t hash{hashBytes(0xcbf29ce484222325ULL, view.data(), headSize)};
+  if (view.size() > headSize) {
+    uint64_t const tailSize{std::min(view.size() - headSize, HASHED_SIZE)};
+    hash = hashBytes(hash, view.data() + view.size() - tailSize, tailSize);
+  }
+  return hash;
+}
+
+AnalysisCache::AnalysisCache(std::string const &filename):
+  m_mutex{},
+  m_records{},
+  m_file{}
+{
+  // A file that is not a cache is left as it is, and the cache is then not
+  // good. One with only part of the header was cut short when created.
+  bool isEmpty{true};
+  bool hasHeader{false};
+  bool isTorn{false};
+  {
+    std::ifstream in(filename);
+    std::string line;
+    if (std::getline(in, line)) {
+      hasHeader = (line == CACHE_HEADER && !in.eof());
+      isEmpty = (!hasHeader && in.eof() 
+          && std::string_view(CACHE_HEADER).substr(0, line.size()) == line);
+    }
+    while (hasHeader && std::getline(in, line)) {
+      // A last line without a newline was cut short when the run was
+      // interrupted.
+      if (in.eof()) {
+        isTorn = true;
+        break;
+      }
+      size_t const tab{line.find('\t')};
+      if (tab == std::string::npos) {
+        continue;
+      }
+      std::istringstream fields(line.substr(0, tab));
+      std::vector<std::string> f;
+      std::string field;
+      while (fields >> field) {
+        f.push_back(field);
+      }
+      if (f.size() != FIELD_COUNT) {
+        continue;
+      }
+      // Parsed with strtod since a mean over no samples is stored as nan.
+      auto toUint{[](std::string const &s) { 
+          return std::strtoull(s.c_str(), nullptr, 10); 
+        }};
+      auto toDouble{[](std::string const &s) { 
+          return std::strtod(s.c_str(), nullptr); 
+        }};
+
+      Record r{};
+      r.size = toUint(f[0]);
+      r.modifiedTime = std::strtoll(f[1].c_str(), nullptr, 10);
+      r.contentHash = toUint(f[2]);
+      r.analysis.statistics = AccelerationStatistics{toDouble(f[3]), 
+        toDouble(f[4]), toDouble(f[5]), toDouble(f[6]), toUint(f[7])};
+      r.analysis.classification = Classification{f[8] == "1", f[9] == "1", 
+        f[10] == "1", f[11] == "1"};
+      r.analysis.outOfOrderCount = toUint(f[12]);
+      r.analysis.window = toUint(f[13]);
+      r.analysis.isWindowBounded = (f[14] == "1");
+      m_records[line.substr(tab + 1)] = r;
+    }
+  }
+
+  if (hasHeader) {
+    m_file.open(filename, std::ios::app);
+    if (isTorn) {
+      m_file << '\n' << std::flush;
+    }
+  } else if (isEmpty) {
+    m_file.open(filename, std::ios::trunc);
+    m_file << CACHE_HEADER << std::endl;
+  }
+}
+
+bool AnalysisCache::isGood() const noexcept
+{
+  return m_file.is_open() && m_file.good();
+}
+
+uint64_t AnalysisCache::size() const noexcept
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_records.size();
+}
+
+bool AnalysisCache::find(RecFileKey const &key, RecAnalysis &analysis) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it{m_records.find(key.path)};
+  if (it == m_records.end() || it->second.size != key.size 
+      || it->second.modifiedTime != key.modifiedTime 
+      || it->second.contentHash != key.contentHash) {
+    return false;
+  }
+  analysis = it->second.analysis;
+  return true;
+}
+
+// Finds the analysis of a file from its path, size, and modification time
+// alone, without reading any of it. Since the contents are not compared,
+// this is only good enough to estimate how costly the file is to process.
+bool AnalysisCache::findUnread(std::string const &filename, uint64_t size, 
+    RecAnalysis &analysis) const
+{
+  std::string const path{std::filesystem::absolute(filename)
+    .lexically_normal().string()};
+  int64_t const time{modifiedTime(filename)};
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it{m_records.find(path)};
+  if (it == m_records.end() || it->second.size != size 
+      || it->second.modifiedTime != time) {
+    return false;
+  }
+  analysis = it->second.analysis;
+  return true;
+}
+
+void AnalysisCache::store(RecFileKey const &key, RecAnalysis const &analysis)
+{
+  if (key.path.find('\n') != std::string::npos) {
+    return;
+  }
+
+  AccelerationStatistics const &s{analysis.statistics};
+  Classification const &c{analysis.classification};
+  std::ostringstream line;
+  line << std::setprecision(17) << key.size << ' ' << key.modifiedTime << ' ' 
+    << key.contentHash << ' ' << s.lengthMean << ' ' << s.xChangeMax << ' ' 
+    << s.yChangeMax << ' ' << s.zChangeMax << ' ' << s.sampleCount << ' ' 
+    << c.isBeforeSiPatch << ' ' << c.isFromBrokenPatch << ' ' 
+    << c.removeSwitchStateReadings << ' ' << c.isFine << ' ' 
+    << analysis.outOfOrderCount << ' ' << analysis.window << ' ' 
+    << analysis.isWindowBounded << '\t' << key.path << '\n';
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_records[key.path] = Record{key.size, key.modifiedTime, key.contentHash, 
+    analysis};
+  m_file << line.str() << std::flush;
+}
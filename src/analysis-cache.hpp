@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANALYSIS_CACHE_HPP
+#define ANALYSIS_CACHE_HPP
+
+#include "classifier.hpp"
+#include "rec-file-view.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Identifies the contents of a recording without reading all of it. The
+// content hash covers the first and last 64 KiB of the file.
+struct RecFileKey {
+  std::string path;
+  uint64_t size;
+  int64_t modifiedTime;
+  uint64_t contentHash;
+};
+
+RecFileKey recFileKey(std::string const &, RecFileView const &);
+uint64_t sampledContentHash(RecFileView const &) noexcept;
+
+// What the analysis scan found out about a recording. The window is only
+// known if it is bounded, i.e., if it fitted the reorder window in use when
+// the recording was scanned.
+struct RecAnalysis {
+  AccelerationStatistics statistics;
+  Classification classification;
+  uint64_t outOfOrderCount;
+  uint64_t window;
+  bool isWindowBounded;
+};
+
+// A persistent record of earlier analysis scans, kept as one line of text
+// per recording. New results are appended as soon as they are known, and
+// later lines replace earlier ones for the same path when loaded. A file
+// is only created if missing or empty, and one that is not a cache is never
+// overwritten. Shared between all workers.
+class AnalysisCache {
+ private:
+  struct Record {
+    uint64_t size;
+    int64_t modifiedTime;
+    uint64_t contentHash;
+    RecAnalysis analysis;
+  };
+
+ public:
+  AnalysisCache(std::string const &);
+  ~AnalysisCache() = default;
+
+ private:
+  AnalysisCache(AnalysisCache const &) = delete;
+  AnalysisCache(AnalysisCache &&) = delete;
+  AnalysisCache &operator=(AnalysisCache const &) = delete;
+  AnalysisCache &operator=(AnalysisCache &&) = delete;
+
+ public:
+  bool isGood() const noexcept;
+  uint64_t size() const noexcept;
+  bool find(RecFileKey const &, RecAnalysis &) const;
+  bool findUnread(std::string const &, uint64_t, RecAnalysis &) const;
+  void store(RecFileKey const &, RecAnalysis const &);
+
+ private:
+  mutable std::mutex m_mutex;
+  std::unordered_map<std::string, Record> m_records;
+  std::ofstream m_file;
+};
+
+#endif
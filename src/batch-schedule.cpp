@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batch-schedule.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Rough costs per byte of each step, relative to the analysis scan.
+constexpr double ANALYSIS_COST{1.0};
+constexpr double COPY_COST{0.5};
+constexpr double REWRITE_COST{3.0};
+constexpr double SORT_COST{2.0};
+
+}
+
+// The cost of a recording of the given size. With a cached analysis, the
+// scan is skipped and it is known if the recording is only copied, and if
+// it needs to be sorted. Without one, the recording is expected to be
+// scanned and rewritten in order.
+double estimateCost(uint64_t size, RecAnalysis const *analysis) noexcept
+{
+  double const bytes{static_cast<double>(size)};
+  if (analysis == nullptr) {
+    return bytes * (ANALYSIS_COST + REWRITE_COST);
+  }
+  if (analysis->classification.isFine) {
+    return bytes * COPY_COST;
+  }
+  if (analysis->outOfOrderCount > 0 && !analysis->isWindowBounded) {
+    return bytes * (REWRITE_COST + SORT_COST);
+  }
+  return bytes * REWRITE_COST;
+}
+
+// Orders the recordings by descending cost, so that workers picking the
+// next one in turn never start a long recording once the others are nearly
+// done. This longest-processing-time-first order finishes a batch at most 
+// a third later than the best possible order.
+void scheduleLargestFirst(std::vector<BatchFile> &files)
+{
+  std::sort(files.begin(), files.end(), 
+      [](BatchFile const &a, BatchFile const &b) {
+        if (a.cost > b.cost || a.cost < b.cost) {
+          return a.cost > b.cost;
+        }
+        return a.relativeFilename < b.relativeFilename;
+      });
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_SCHEDULE_HPP
+#define BATCH_SCHEDULE_HPP
+
+#include "analysis-cache.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A recording waiting to be processed, with the time it is expected to
+// take in units of reading one byte in the analysis scan.
+struct BatchFile {
+  std::string relativeFilename;
+  uint64_t size;
+  double cost;
+};
+
+double estimateCost(uint64_t, RecAnalysis const *) noexcept;
+void scheduleLargestFirst(std::vector<BatchFile> &);
+
+#endif
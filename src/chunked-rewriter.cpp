@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunked-rewriter.hpp"
+
+#include <exception>
+#include <thread>
+
+namespace {
+
+// The state after a chunk, given the state before it. Types that the chunk
+// kept no readings of carry the state from before the chunk.
+EnvelopeTransformer::DedupState carriedState(
+    EnvelopeTransformer::DedupState const &before, 
+    EnvelopeTransformer::DedupState const &chunk) noexcept
+{
+  EnvelopeTransformer::DedupState state{before};
+  for (size_t i{0}; i < state.readings.size(); i++) {
+    if (chunk.readings[i].isFound) {
+      state.readings[i] = chunk.readings[i];
+    }
+  }
+  return state;
+}
+
+}
+
+ChunkedRewriter::ChunkedRewriter(RecFileView const &view, 
+    Classification const &classification, CorrectionRules const &rules, 
+    uint32_t threadCount) noexcept:
+  m_view{view},
+  m_classification{classification},
+  m_rules{rules},
+  m_threadCount{std::max(threadCount, 1U)},
+  m_redoneChunkCount{0},
+  m_stats{nullptr}
+{
+}
+
+// Rewrites the frames from the first of the given chunk offsets to the end
+// of the file, all of which must be offsets of frames in ascending order.
+// The skipped readings and Envelopes are added to the summary of the given
+// transformer, which has not been used for any frames itself, and the time
+// spent to its stats, if any.
+void ChunkedRewriter::rewrite(std::vector<uint64_t> const &chunkOffsets, 
+    EnvelopeTransformer &summary, EnvelopeTransformer::Indexer const &indexer, 
+    OutputSink &sink)
+{
+  bool const isIndexed{static_cast<bool>(indexer)};
+  EnvelopeTransformer::DedupState state{summary.dedupState()};
+  m_stats = summary.stats();
+  bool isFirstChunk{true};
+
+  for (size_t roundBegin{0}; roundBegin < chunkOffsets.size(); 
+      roundBegin += m_threadCount) {
+    size_t const roundEnd{std::min(roundBegin + m_threadCount, 
+        chunkOffsets.size())};
+
+    std::vector<Chunk> chunks(roundEnd - roundBegin);
+    std::vector<std::exception_ptr> errors(chunks.size());
+    std::vector<std::thread> threads;
+    for (size_t i{0}; i < chunks.size(); i++) {
+      size_t const j{roundBegin + i};
+      chunks[i].begin = chunkOffsets[j];
+      chunks[i].end = (j + 1 < chunkOffsets.size()) ? chunkOffsets[j + 1] 
+        : m_view.size();
+      threads.emplace_back([this, &chunks, &errors, i, isIndexed]() {
+          try {
+            transformChunk(chunks[i], nullptr, isIndexed);
+          } catch (...) {
+            errors[i] = std::current_exception();
+          }
+        });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    for (auto const &error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+
+    // Fix up the seams in order, and write.
+    for (auto &chunk : chunks) {
+      if (!isFirstChunk && !isKeptAfter(chunk, state)) {
+        transformChunk(chunk, &state, isIndexed);
+        m_redoneChunkCount++;
+      }
+      isFirstChunk = false;
+      state = carriedState(state, chunk.transformer->dedupState());
+
+      uint64_t const base{sink.size()};
+      {
+        StageTimer timer(m_stats, Stage::Write);
+        sink.write(chunk.output);
+      }
+      for (auto entry : chunk.index) {
+        entry.offset += base;
+        indexer(entry);
+      }
+      summary.addSummary(*chunk.transformer);
+    }
+  }
+}
+
+uint32_t ChunkedRewriter::redoneChunkCount() const noexcept
+{
+  return m_redoneChunkCount;
+}
+
+// Transforms the frames of the chunk into its output, from the given state
+// or, if none, as if the chunk started the recording.
+void ChunkedRewriter::transformChunk(Chunk &chunk, 
+    EnvelopeTransformer::DedupState const *state, bool isIndexed) const
+{
+  chunk.transformer = std::make_unique<EnvelopeTransformer>(m_classification, 
+      m_rules);
+  chunk.transformer->setStats(m_stats);
+  chunk.output.clear();
+  chunk.index.clear();
+  chunk.firstKept.clear();
+  EnvelopeTransformer &transformer{*chunk.transformer};
+  if (state != nullptr) {
+    transformer.setDedupState(*state);
+  }
+  if (isIndexed) {
+    transformer.setIndexer([&chunk](IndexEntry const &entry) {
+        chunk.index.push_back(entry);
+      });
+  }
+  auto writeBatch{[&transformer, &chunk](EnvelopeTransformer::Batch &batch) {
+      transformer.writeBatch(batch, chunk.output);
+    }};
+
+  EnvelopeSpan span;
+  uint64_t pos{chunk.begin};
+  while (m_view.next(pos, span) && span.offset < chunk.end) {
+    std::string_view const frame{m_view.frame(span)};
+    if (!transformer.handles(span.dataType)) {
+      transformer.push(frame, span, writeBatch);
+      continue;
+    }
+    bool isFirst{true};
+    for (auto const &kept : chunk.firstKept) {
+      if (kept.second.dataType == span.dataType) {
+        isFirst = false;
+        break;
+      }
+    }
+    uint64_t const outputSize{transformer.outputSize()};
+    transformer.push(frame, span, writeBatch);
+    if (isFirst && transformer.outputSize() > outputSize) {
+      chunk.firstKept.emplace_back(frame, span);
+    }
+  }
+  transformer.flush(writeBatch);
+}
+
+// Checks if the first kept reading of each type in the chunk is also kept
+// when starting from the given state.
+bool ChunkedRewriter::isKeptAfter(Chunk const &chunk, 
+    EnvelopeTransformer::DedupState const &state) const
+{
+  auto discardBatch{[](EnvelopeTransformer::Batch &batch) {
+      batch = EnvelopeTransformer::Batch{};
+    }};
+  for (auto const &kept : chunk.firstKept) {
+    EnvelopeTransformer probe(m_classification, m_rules);
+    probe.setDedupState(state);
+    probe.push(kept.first, kept.second, discardBatch);
+    if (probe.outputSize() == 0) {
+      return false;
+    }
+  }
+  return true;
+}
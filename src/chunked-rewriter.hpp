@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHUNKED_REWRITER_HPP
+#define CHUNKED_REWRITER_HPP
+
+#include "classifier.hpp"
+#include "correction-rules.hpp"
+#include "envelope-transformer.hpp"
+#include "output-sink.hpp"
+#include "rec-file-view.hpp"
+#include "stage-stats.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Rewrites a recording that is already in time order as chunks that are
+// transformed concurrently, a round of one chunk per thread at a time.
+//
+// The only state carried from one Envelope to the next is that of the
+// duplicate detection, and it only depends on the last kept reading of each
+// type. Each chunk is therefore first transformed as if it started the
+// recording. At the seam, the first reading of each type that the chunk
+// kept is checked against the state carried from the previous chunk: if
+// it is still kept, all later decisions in the chunk are the same, and
+// otherwise the chunk is transformed again from the carried state.
+class ChunkedRewriter {
+ private:
+  struct Chunk {
+    uint64_t begin{0};
+    uint64_t end{0};
+    std::unique_ptr<EnvelopeTransformer> transformer{};
+    std::string output{};
+    std::vector<IndexEntry> index{};
+    std::vector<std::pair<std::string_view, EnvelopeSpan>> firstKept{};
+  };
+
+ public:
+  ChunkedRewriter(RecFileView const &, Classification const &, 
+      CorrectionRules const &, uint32_t) noexcept;
+  ~ChunkedRewriter() = default;
+
+ private:
+  ChunkedRewriter(ChunkedRewriter const &) = delete;
+  ChunkedRewriter(ChunkedRewriter &&) = delete;
+  ChunkedRewriter &operator=(ChunkedRewriter const &) = delete;
+  ChunkedRewriter &operator=(ChunkedRewriter &&) = delete;
+
+ public:
+  void rewrite(std::vector<uint64_t> const &, EnvelopeTransformer &, 
+      EnvelopeTransformer::Indexer const &, OutputSink &);
+  uint32_t redoneChunkCount() const noexcept;
+
+ private:
+  void transformChunk(Chunk &, EnvelopeTransformer::DedupState const *, 
+      bool) const;
+  bool isKeptAfter(Chunk const &, 
+      EnvelopeTransformer::DedupState const &) const;
+
+ private:
+  RecFileView const &m_view;
+  Classification const m_classification;
+  CorrectionRules const &m_rules;
+  uint32_t const m_threadCount;
+  uint32_t m_redoneChunkCount;
+  FileStats *m_stats;
+};
+
+#endif
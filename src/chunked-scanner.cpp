@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunked-scanner.hpp"
+
+#include <atomic>
+#include <exception>
+#include <thread>
+
+ChunkedScanner::ChunkedScanner(RecFileView const &view, uint32_t threadCount, 
+    uint64_t chunkSize, bool collectIndex) noexcept:
+  m_view{view},
+  m_threadCount{std::max(threadCount, 1U)},
+  m_chunkSize{std::max<uint64_t>(chunkSize, 1)},
+  m_collectIndex{collectIndex},
+  m_classifier{},
+  m_isOrdered{true},
+  m_index{},
+  m_chunkOffsets{},
+  m_rescannedChunkCount{0}
+{
+}
+
+void ChunkedScanner::scan()
+{
+  std::vector<Chunk> chunks;
+  for (uint64_t begin{0}; begin < m_view.size(); ) {
+    uint64_t const end{std::min(m_view.size(), 
+        m_view.findFrame(begin + m_chunkSize, begin + 2 * m_chunkSize))};
+    Chunk chunk;
+    chunk.begin = begin;
+    chunk.end = end;
+    chunks.push_back(std::move(chunk));
+    begin = end;
+  }
+
+  std::atomic<size_t> nextChunk{0};
+  std::vector<std::exception_ptr> errors(m_threadCount);
+  auto worker{[this, &chunks, &nextChunk, &errors](uint32_t t) {
+      try {
+        for (size_t i{nextChunk++}; i < chunks.size(); i = nextChunk++) {
+          scanChunk(chunks[i], chunks[i].begin);
+        }
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    }};
+  std::vector<std::thread> threads;
+  for (uint32_t t{0}; t < m_threadCount; t++) {
+    threads.emplace_back(worker, t);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto const &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Merge in file order, rescanning chunks that started at a wrong guess.
+  uint64_t nextOffset{0};
+  int64_t maxTimeStamp{0};
+  bool hasFrames{false};
+  for (auto &chunk : chunks) {
+    if (chunk.begin != nextOffset) {
+      scanChunk(chunk, nextOffset);
+      m_rescannedChunkCount++;
+    }
+    nextOffset = chunk.nextOffset;
+    if (!chunk.hasFrames) {
+      continue;
+    }
+
+    m_chunkOffsets.push_back(chunk.firstOffset);
+    m_classifier.merge(chunk.classifier);
+    if (!chunk.isOrdered || (hasFrames && chunk.firstTimeStamp < maxTimeStamp)) {
+      m_isOrdered = false;
+    }
+    maxTimeStamp = hasFrames ? std::max(maxTimeStamp, chunk.maxTimeStamp) 
+      : chunk.maxTimeStamp;
+    hasFrames = true;
+    m_index.insert(m_index.end(), chunk.index.begin(), chunk.index.end());
+    chunk.index = std::vector<IndexEntry>{};
+  }
+}
+
+Classifier const &ChunkedScanner::classifier() const noexcept
+{
+  return m_classifier;
+}
+
+bool ChunkedScanner::isOrdered() const noexcept
+{
+  return m_isOrdered;
+}
+
+// The Envelopes in file order, if collected.
+std::vector<IndexEntry> &ChunkedScanner::index() noexcept
+{
+  return m_index;
+}
+
+// The offset of the first frame of each chunk.
+std::vector<uint64_t> const &ChunkedScanner::chunkOffsets() const noexcept
+{
+  return m_chunkOffsets;
+}
+
+uint32_t ChunkedScanner::rescannedChunkCount() const noexcept
+{
+  return m_rescannedChunkCount;
+}
+
+// Scans the frames of the chunk, starting at pos. The frames found are the
+// ones that a scan of the whole file would find before the chunk end, as
+// long as that scan also gets to pos.
+void ChunkedScanner::scanChunk(Chunk &chunk, uint64_t pos) const
+{
+  chunk.nextOffset = m_view.size();
+  chunk.classifier = Classifier{};
+  chunk.hasFrames = false;
+  chunk.isOrdered = true;
+  chunk.index.clear();
+
+  EnvelopeSpan span;
+  while (m_view.next(pos, span)) {
+    if (span.offset >= chunk.end) {
+      chunk.nextOffset = span.offset;
+      break;
+    }
+    if (!chunk.hasFrames) {
+      chunk.hasFrames = true;
+      chunk.firstOffset = span.offset;
+      chunk.firstTimeStamp = span.sampleTimeStamp;
+      chunk.maxTimeStamp = span.sampleTimeStamp;
+    } else if (span.sampleTimeStamp < chunk.maxTimeStamp) {
+      chunk.isOrdered = false;
+    } else {
+      chunk.maxTimeStamp = span.sampleTimeStamp;
+    }
+    if (m_collectIndex) {
+      chunk.index.push_back(IndexEntry{span.sampleTimeStamp, span.offset, 
+          span.length, span.dataType, span.senderStamp});
+    }
+    chunk.classifier.add(span.dataType, m_view.serializedData(span));
+  }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHUNKED_SCANNER_HPP
+#define CHUNKED_SCANNER_HPP
+
+#include "classifier.hpp"
+#include "rec-file-view.hpp"
+#include "rec-index.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Runs the analysis scan of a recording as chunks on several threads.
+//
+// A chunk starts at the first frame found after its nominal start, which
+// is only a guess, since a frame header may as well be part of the payload
+// of another frame. The guess is confirmed when the scan of the previous
+// chunk continues exactly at it; otherwise the chunk is scanned again from
+// where the previous one ended. The results of the chunks are then merged,
+// so that they are the same as from a single scan, except for the rounding
+// of the acceleration length sum (see Classifier::isNearThreshold).
+class ChunkedScanner {
+ private:
+  struct Chunk {
+    uint64_t begin{0};
+    uint64_t end{0};
+    uint64_t nextOffset{0};
+    uint64_t firstOffset{0};
+    Classifier classifier{};
+    bool hasFrames{false};
+    bool isOrdered{true};
+    int64_t firstTimeStamp{0};
+    int64_t maxTimeStamp{0};
+    std::vector<IndexEntry> index{};
+  };
+
+ public:
+  ChunkedScanner(RecFileView const &, uint32_t, uint64_t, bool) noexcept;
+  ~ChunkedScanner() = default;
+
+ private:
+  ChunkedScanner(ChunkedScanner const &) = delete;
+  ChunkedScanner(ChunkedScanner &&) = delete;
+  ChunkedScanner &operator=(ChunkedScanner const &) = delete;
+  ChunkedScanner &operator=(ChunkedScanner &&) = delete;
+
+ public:
+  void scan();
+  Classifier const &classifier() const noexcept;
+  bool isOrdered() const noexcept;
+  std::vector<IndexEntry> &index() noexcept;
+  std::vector<uint64_t> const &chunkOffsets() const noexcept;
+  uint32_t rescannedChunkCount() const noexcept;
+
+ private:
+  void scanChunk(Chunk &, uint64_t) const;
+
+ private:
+  RecFileView const &m_view;
+  uint32_t const m_threadCount;
+  uint64_t const m_chunkSize;
+  bool const m_collectIndex;
+  Classifier m_classifier;
+  bool m_isOrdered;
+  std::vector<IndexEntry> m_index;
+  std::vector<uint64_t> m_chunkOffsets;
+  uint32_t m_rescannedChunkCount;
+};
+
+#endif
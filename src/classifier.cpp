@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "opendlv-standard-message-set.hpp"
+
+#include "classifier.hpp"
+#include "rec-file-view.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// As in add(), so that changes that are not a number are ignored in the
+// same way.
+void updateMax(double &changeMax, double change) noexcept
+{
+  if (change > changeMax) {
+    changeMax = change;
+  }
+}
+
+}
+
+Classifier::Classifier() noexcept:
+  m_lengthSum{0.0},
+  m_xFirst{0.0},
+  m_yFirst{0.0},
+  m_zFirst{0.0},
+  m_xPrev{0.0},
+  m_yPrev{0.0},
+  m_zPrev{0.0},
+  m_xChangeMax{0.0},
+  m_yChangeMax{0.0},
+  m_zChangeMax{0.0},
+  m_sampleCount{0},
+  m_removeSwitchStateReadings{false},
+  m_isMerged{false}
+{
+}
+
+void Classifier::add(int32_t dataType, std::string_view serializedData)
+{
+  if (dataType != opendlv::proxy::AccelerationReading::ID()) {
+    return;
+  }
+
+  // Decoded directly from the serialized bytes, in the same way as by
+  // cluon::extractMessage, but without allocating.
+  float v[3];
+  decodeReadingFields(serializedData, v, 3, nullptr, 0);
+
+  m_removeSwitchStateReadings = true;
+
+  double x = v[0];
+  double y = v[1];
+  double z = v[2];
+
+  m_lengthSum += std::sqrt(x * x + y * y + z * z);
+
+  if (m_sampleCount != 0) {
+    double xChange = std::abs(x - m_xPrev);
+    if (xChange > m_xChangeMax) {
+      m_xChangeMax = xChange;
+    }
+    double yChange = std::abs(y - m_yPrev);
+    if (yChange > m_yChangeMax) {
+      m_yChangeMax = yChange;
+    }
+    double zChange = std::abs(z - m_zPrev);
+    if (zChange > m_zChangeMax) {
+      m_zChangeMax = zChange;
+    }
+  } else {
+    m_xFirst = x;
+    m_yFirst = y;
+    m_zFirst = z;
+  }
+
+  m_xPrev = x;
+  m_yPrev = y;
+  m_zPrev = z;
+
+  m_sampleCount++;
+}
+
+// Adds the statistics of the part of the recording right after the part
+// of this classifier. The changes across the seam are found from the last
+// and first readings of the two parts, so the largest changes are exact.
+// The length sum is not, since it is added up in another order.
+void Classifier::merge(Classifier const &next) noexcept
+{
+  if (next.m_sampleCount == 0) {
+    return;
+  }
+  if (m_sampleCount == 0) {
+    *this = next;
+    m_isMerged = true;
+    return;
+  }
+
+  updateMax(m_xChangeMax, std::abs(next.m_xFirst - m_xPrev));
+  updateMax(m_yChangeMax, std::abs(next.m_yFirst - m_yPrev));
+  updateMax(m_zChangeMax, std::abs(next.m_zFirst - m_zPrev));
+  combine(next);
+}
+
+// Adds the statistics of another part of the recording, that is not next
+// to the part of this classifier. Changes across the gap are not known, and
+// are left out.
+void Classifier::combine(Classifier const &other) noexcept
+{
+  if (other.m_sampleCount == 0) {
+    return;
+  }
+  if (m_sampleCount == 0) {
+    *this = other;
+    m_isMerged = true;
+    return;
+  }
+
+  updateMax(m_xChangeMax, other.m_xChangeMax);
+  updateMax(m_yChangeMax, other.m_yChangeMax);
+  updateMax(m_zChangeMax, other.m_zChangeMax);
+  m_lengthSum += other.m_lengthSum;
+  m_xPrev = other.m_xPrev;
+  m_yPrev = other.m_yPrev;
+  m_zPrev = other.m_zPrev;
+  m_sampleCount += other.m_sampleCount;
+  m_removeSwitchStateReadings = true;
+  m_isMerged = true;
+}
+
+// Returns true if the classification of merged parts might differ from one
+// found in a single pass, i.e., if the mean length is so close to one of
+// the thresholds that the rounding of the length sum matters. The rounding
+// errors of both sums are each at most n machine epsilons of the sum.
+bool Classifier::isNearThreshold() const noexcept
+{
+  if (!m_isMerged || m_xChangeMax > 2500.0 || m_yChangeMax > 2500.0 
+      || m_zChangeMax > 2500.0) {
+    return false;
+  }
+  double const lengthMean{m_lengthSum / m_sampleCount};
+  double const tolerance{4.0 * m_sampleCount 
+    * std::numeric_limits<double>::epsilon() * lengthMean};
+  return std::abs(lengthMean - 1000.0) <= tolerance 
+    || std::abs(lengthMean - 1060.0) <= tolerance;
+}
+
+AccelerationStatistics Classifier::statistics() const noexcept
+{
+  return AccelerationStatistics{m_lengthSum / m_sampleCount, m_xChangeMax, 
+    m_yChangeMax, m_zChangeMax, m_sampleCount};
+}
+
+Classification Classifier::classification() const noexcept
+{
+  double lengthMean = m_lengthSum / m_sampleCount;
+
+  Classification c{false, false, m_removeSwitchStateReadings, true};
+  c.isFromBrokenPatch = (m_xChangeMax > 2500.0 || m_yChangeMax > 2500.0 
+      || m_zChangeMax > 2500.0);
+  if (!c.isFromBrokenPatch) {
+    c.isBeforeSiPatch = (lengthMean > 1000.0 && lengthMean < 1060);
+  }
+  c.isFine = (!c.isBeforeSiPatch && !c.isFromBrokenPatch 
+      && !c.removeSwitchStateReadings);
+  return c;
+}
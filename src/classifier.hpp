@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLASSIFIER_HPP
+#define CLASSIFIER_HPP
+
+#include "cluon-complete.hpp"
+
+#include <cstdint>
+#include <string_view>
+
+// Which corrections a recording needs, decided from its acceleration
+// readings.
+struct Classification {
+  bool isBeforeSiPatch;
+  bool isFromBrokenPatch;
+  bool removeSwitchStateReadings;
+  bool isFine;
+};
+
+// The statistics of the AccelerationReadings in a recording that the
+// Classification is decided from.
+struct AccelerationStatistics {
+  double lengthMean;
+  double xChangeMax;
+  double yChangeMax;
+  double zChangeMax;
+  uint64_t sampleCount;
+};
+
+// Accumulates the statistics of all AccelerationReadings in a recording, in
+// file order, to decide if it was recorded before the SI patch (mean
+// acceleration length in mG) or with the broken patch (jumps in the values).
+// Classifiers of consecutive parts of a recording can be merged.
+class Classifier {
+ public:
+  Classifier() noexcept;
+  ~Classifier() = default;
+
+ public:
+  void add(int32_t, std::string_view);
+  void merge(Classifier const &) noexcept;
+  void combine(Classifier const &) noexcept;
+  bool isNearThreshold() const noexcept;
+  AccelerationStatistics statistics() const noexcept;
+  Classification classification() const noexcept;
+
+ private:
+  double m_lengthSum;
+  double m_xFirst;
+  double m_yFirst;
+  double m_zFirst;
+  double m_xPrev;
+  double m_yPrev;
+  double m_zPrev;
+  double m_xChangeMax;
+  double m_yChangeMax;
+  double m_zChangeMax;
+  uint64_t m_sampleCount;
+  bool m_removeSwitchStateReadings;
+  bool m_isMerged;
+};
+
+#endif
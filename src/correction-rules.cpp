@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "message-schemas.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "peak-gps.hpp"
+
+#include "correction-rules.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Conversion constants.
+float const mG_to_mps2{9.80665f/1000.f};
+float const mT_to_T{1e-6f};
+
+// A message without rules, with the float and uint8 fields of its schema,
+// if any, and if they are within the limits.
+MessageRule messageRule(int32_t dataType, std::string const &name)
+{
+  MessageRule rule{};
+  rule.dataType = dataType;
+  rule.name = name;
+  ReadingLayout const layout{readingLayout(dataType)};
+  if (layout.isReading && layout.floatCount <= MAX_RULE_FLOATS 
+      && layout.byteCount <= MAX_RULE_BYTES) {
+    rule.floatCount = layout.floatCount;
+    rule.byteCount = layout.byteCount;
+  }
+  return rule;
+}
+
+RuleCondition parseCondition(std::string const &str)
+{
+  if (str == "before-si-patch") {
+    return RuleCondition::BeforeSiPatch;
+  }
+  if (str == "from-broken-patch") {
+    return RuleCondition::FromBrokenPatch;
+  }
+  if (str == "with-acceleration-readings") {
+    return RuleCondition::WithAccelerationReadings;
+  }
+  throw std::invalid_argument("Unknown condition '" + str + "'");
+}
+
+// The numbers are parsed in full, so that a typo is not taken as a prefix.
+double parseDouble(std::string const &str)
+{
+  char *end{nullptr};
+  double const value{std::strtod(str.c_str(), &end)};
+  if (end == str.c_str() || *end != '\0') {
+    throw std::invalid_argument("Not a number: '" + str + "'");
+  }
+  return value;
+}
+
+float parseFloat(std::string const &str)
+{
+  char *end{nullptr};
+  float const value{std::strtof(str.c_str(), &end)};
+  if (end == str.c_str() || *end != '\0') {
+    throw std::invalid_argument("Not a number: '" + str + "'");
+  }
+  return value;
+}
+
+uint32_t parseCount(std::string const &str, uint32_t max)
+{
+  char *end{nullptr};
+  unsigned long const value{std::strtoul(str.c_str(), &end, 10)};
+  if (end == str.c_str() || *end != '\0' || value > max) {
+    throw std::invalid_argument("Expected a count of at most " 
+        + std::to_string(max) + ", not '" + str + "'");
+  }
+  return static_cast<uint32_t>(value);
+}
+
+// message <id> <name> [floats <count>] [bytes <count>]
+//
+// The counts are only needed for messages that are not in the message 
+// sets, and must otherwise match their schemas.
+MessageRule parseMessage(std::vector<std::string> const &words)
+{
+  if (words.size() < 3) {
+    throw std::invalid_argument("Expected message <id> <name>");
+  }
+  uint32_t const dataType{parseCount(words[1], MAX_RULE_DATA_TYPE)};
+  if (dataType == 0) {
+    throw std::invalid_argument("Message ids start at 1");
+  }
+  MessageRule rule{messageRule(static_cast<int32_t>(dataType), words[2])};
+  bool const hasSchema{findMessageSchema(rule.dataType) != nullptr};
+  for (size_t i{3}; i < words.size(); i += 2) {
+    if (i + 1 == words.size()) {
+      throw std::invalid_argument("Expected a count after " + words[i]);
+    }
+    uint32_t *count{nullptr};
+    uint32_t max{0};
+    if (words[i] == "floats") {
+      count = &rule.floatCount;
+      max = MAX_RULE_FLOATS;
+    } else if (words[i] == "bytes") {
+      count = &rule.byteCount;
+      max = MAX_RULE_BYTES;
+    } else {
+      throw std::invalid_argument("Unknown field kind '" + words[i] + "'");
+    }
+    uint32_t const value{parseCount(words[i + 1], max)};
+    if (hasSchema && value != *count) {
+      throw std::invalid_argument("Message " + words[1] + " has " 
+          + std::to_string(*count) + " " + words[i] 
+          + " in its schema");
+    }
+    *count = value;
+  }
+  return rule;
+}
+
+// <rule> [<arguments>] [when <condition>]
+void parseRule(std::vector<std::string> const &words, MessageRule &rule)
+{
+  RuleCondition condition{RuleCondition::Always};
+  size_t wordCount{words.size()};
+  if (wordCount >= 2 && words[wordCount - 2] == "when") {
+    condition = parseCondition(words[wordCount - 1]);
+    wordCount -= 2;
+  }
+
+  std::string const &kind{words[0]};
+  auto expectArguments{[&kind, wordCount](size_t count) {
+      if (wordCount != count + 1) {
+        throw std::invalid_argument("Expected " + std::to_string(count) 
+            + " arguments to " + kind);
+      }
+    }};
+  if (kind != "remove" && rule.floatCount == 0) {
+    throw std::invalid_argument("The " + kind + " rule needs float fields");
+  }
+
+  if (kind == "remove") {
+    expectArguments(0);
+    rule.remove = condition;
+  } else if (kind == "min-abs") {
+    expectArguments(1);
+    rule.minAbs = condition;
+    rule.minAbsValue = parseDouble(words[1]);
+  } else if (kind == "outlier") {
+    expectArguments(1);
+    rule.outlier = condition;
+    rule.outlierRatio = parseDouble(words[1]);
+  } else if (kind == "dedup") {
+    expectArguments(0);
+    rule.dedup = condition;
+  } else if (kind == "scale") {
+    expectArguments(1);
+    rule.scale = condition;
+    rule.factor = parseFloat(words[1]);
+  } else if (kind == "threshold-offset") {
+    expectArguments(2);
+    rule.thresholdOffset = condition;
+    rule.threshold = parseFloat(words[1]);
+    rule.offset = parseFloat(words[2]);
+  } else {
+    throw std::invalid_argument("Unknown rule '" + kind + "'");
+  }
+}
+
+}
+
+// The corrections needed by the recordings of the PEAK GPS.
+CorrectionRules defaultCorrectionRules()
+{
+  MessageRule acceleration{messageRule(
+      opendlv::proxy::AccelerationReading::ID(), "AccelerationReading")};
+  acceleration.scale = RuleCondition::BeforeSiPatch;
+  acceleration.factor = mG_to_mps2;
+  acceleration.thresholdOffset = RuleCondition::FromBrokenPatch;
+  acceleration.threshold = 1250.0f;
+  acceleration.offset = 2512.874f;
+
+  MessageRule peakAcceleration{messageRule(
+      opendlv::device::gps::peak::Acceleration::ID(), "Acceleration")};
+  peakAcceleration.scale = acceleration.scale;
+  peakAcceleration.factor = acceleration.factor;
+  peakAcceleration.thresholdOffset = acceleration.thresholdOffset;
+  peakAcceleration.threshold = acceleration.threshold;
+  peakAcceleration.offset = acceleration.offset;
+
+  MessageRule magneticField{messageRule(
+      opendlv::proxy::MagneticFieldReading::ID(), "MagneticFieldReading")};
+  magneticField.dedup = RuleCondition::Always;
+  magneticField.scale = RuleCondition::BeforeSiPatch;
+  magneticField.factor = mT_to_T;
+  magneticField.thresholdOffset = RuleCondition::FromBrokenPatch;
+  magneticField.threshold = 0.01f;
+  magneticField.offset = 0.0196605f;
+
+  MessageRule angularVelocity{messageRule(
+      opendlv::proxy::AngularVelocityReading::ID(), 
+      "AngularVelocityReading")};
+  angularVelocity.dedup = RuleCondition::Always;
+
+  MessageRule altitude{messageRule(opendlv::proxy::AltitudeReading::ID(), 
+      "AltitudeReading")};
+  altitude.outlier = RuleCondition::Always;
+  altitude.outlierRatio = 0.98;
+  altitude.dedup = RuleCondition::Always;
+
+  MessageRule groundSpeed{altitude};
+  groundSpeed.dataType = opendlv::proxy::GroundSpeedReading::ID();
+  groundSpeed.name = "GroundSpeedReading";
+
+  MessageRule geodeticHeading{altitude};
+  geodeticHeading.dataType = opendlv::proxy::GeodeticHeadingReading::ID();
+  geodeticHeading.name = "GeodeticHeadingReading";
+  geodeticHeading.minAbs = RuleCondition::Always;
+  geodeticHeading.minAbsValue = 0.001;
+
+  MessageRule switchState{messageRule(
+      opendlv::proxy::SwitchStateReading::ID(), "SwitchStateReading")};
+  switchState.remove = RuleCondition::WithAccelerationReadings;
+
+  return CorrectionRules{peakAcceleration, acceleration, magneticField, 
+    angularVelocity, altitude, groundSpeed, geodeticHeading, switchState};
+}
+
+// Loads the rules of a rule file, which replace the default rules. Throws
+// std::invalid_argument, with the line of the error, if the file cannot be
+// read or parsed.
+CorrectionRules loadCorrectionRules(std::string const &filename)
+{
+  std::ifstream in(filename);
+  if (!in) {
+    throw std::invalid_argument("Cannot read the correction rules in " 
+        + filename);
+  }
+
+  CorrectionRules rules;
+  std::string line;
+  uint32_t lineNumber{0};
+  while (std::getline(in, line)) {
+    lineNumber++;
+    std::istringstream fields(line.substr(0, line.find('#')));
+    std::vector<std::string> words;
+    std::string word;
+    while (fields >> word) {
+      words.push_back(word);
+    }
+    if (words.empty()) {
+      continue;
+    }
+
+    try {
+      if (words[0] == "message") {
+        MessageRule rule{parseMessage(words)};
+        for (auto const &other : rules) {
+          if (other.dataType == rule.dataType) {
+            throw std::invalid_argument("Message " 
+                + std::to_string(rule.dataType) + " is listed twice");
+          }
+        }
+        if (rules.size() == MAX_MESSAGE_RULES) {
+          throw std::invalid_argument("More than " 
+              + std::to_string(MAX_MESSAGE_RULES) + " messages");
+        }
+        rules.push_back(std::move(rule));
+      } else if (rules.empty()) {
+        throw std::invalid_argument("Rule before the first message");
+      } else {
+        parseRule(words, rules.back());
+      }
+    } catch (std::invalid_argument const &e) {
+      throw std::invalid_argument(filename + ":" 
+          + std::to_string(lineNumber) + ": " + e.what());
+    }
+  }
+  return rules;
+}
+
+bool conditionHolds(RuleCondition condition, 
+    Classification const &classification) noexcept
+{
+  switch (condition) {
+    case RuleCondition::Never:
+      return false;
+    case RuleCondition::Always:
+      return true;
+    case RuleCondition::BeforeSiPatch:
+      return classification.isBeforeSiPatch;
+    case RuleCondition::FromBrokenPatch:
+      return classification.isFromBrokenPatch;
+    case RuleCondition::WithAccelerationReadings:
+      return classification.removeSwitchStateReadings;
+  }
+  return false;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CORRECTION_RULES_HPP
+#define CORRECTION_RULES_HPP
+
+#include "classifier.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The limits of the messages that rules can be given for.
+constexpr int32_t MAX_RULE_DATA_TYPE{2047};
+constexpr size_t MAX_MESSAGE_RULES{16};
+constexpr uint32_t MAX_RULE_FLOATS{3};
+constexpr uint32_t MAX_RULE_BYTES{2};
+
+// When a rule is applied, decided from the Classification of a recording.
+enum class RuleCondition {
+  Never,
+  Always,
+  BeforeSiPatch,
+  FromBrokenPatch,
+  WithAccelerationReadings
+};
+
+// How the readings of one message type are corrected and checked. The
+// messages are all up to three floats with field ids from 1, followed by
+// up to two uint8 fields. Checked in this order, a reading is removed by:
+//
+//   remove:     all readings,
+//   min-abs:    any field is closer to zero than the value,
+//   outlier:    any field dropped by more than the ratio of the magnitude
+//               of the previously kept reading,
+//   dedup:      any field equals that of the previously kept reading.
+//
+// The floats of kept readings are then corrected as FloatCorrection:
+//
+//   scale:             v = v * factor,
+//   threshold-offset:  if (v > threshold) v -= offset.
+//
+// Each rule is applied only when its condition holds.
+struct MessageRule {
+  int32_t dataType{0};
+  std::string name{};
+  uint32_t floatCount{0};
+  uint32_t byteCount{0};
+  RuleCondition remove{RuleCondition::Never};
+  RuleCondition minAbs{RuleCondition::Never};
+  double minAbsValue{0.0};
+  RuleCondition outlier{RuleCondition::Never};
+  double outlierRatio{0.0};
+  RuleCondition dedup{RuleCondition::Never};
+  RuleCondition scale{RuleCondition::Never};
+  float factor{1.0f};
+  RuleCondition thresholdOffset{RuleCondition::Never};
+  float threshold{0.0f};
+  float offset{0.0f};
+};
+
+using CorrectionRules = std::vector<MessageRule>;
+
+// A rule file lists the messages to handle, each followed by its rules,
+// one per line, that apply always unless given a condition. Messages
+// without rules are passed through as they are. For instance, the
+// built-in rules for magnetic field and altitude readings are:
+//
+//   # message <id> <name> [floats <count>] [bytes <count>]
+//   message 1032 MagneticFieldReading
+//     dedup
+//     scale 1e-6 when before-si-patch
+//     threshold-offset 0.01 0.0196605 when from-broken-patch
+//   message 1033 AltitudeReading
+//     outlier 0.98
+//     dedup
+//
+// The conditions are before-si-patch, from-broken-patch, and 
+// with-acceleration-readings. The float and uint8 fields are taken from 
+// the schemas of the message sets, and only need to be given for other
+// messages. Recordings classified as fine are copied
+// without applying any rules.
+CorrectionRules defaultCorrectionRules();
+CorrectionRules loadCorrectionRules(std::string const &);
+bool conditionHolds(RuleCondition, Classification const &) noexcept;
+
+#endif
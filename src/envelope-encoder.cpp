@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "envelope-encoder.hpp"
+
+#include <cstring>
+#include <utility>
+
+#include <endian.h>
+
+namespace {
+
+constexpr uint32_t OD4_HEADER_SIZE{5};
+
+uint8_t const VARINT{0};
+uint8_t const LENGTH_DELIMITED{2};
+uint8_t const FOUR_BYTES{5};
+
+uint32_t toZigZag32(int32_t v) noexcept
+{
+  return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+uint64_t key(uint32_t fieldId, uint8_t wireType) noexcept
+{
+  return (static_cast<uint64_t>(fieldId) << 3) | wireType;
+}
+
+size_t varIntSize(uint64_t v) noexcept
+{
+  size_t size{1};
+  for (; v > 0x7f; v >>= 7) {
+    size++;
+  }
+  return size;
+}
+
+char *putVarInt(char *p, uint64_t v) noexcept
+{
+  for (; v > 0x7f; v >>= 7) {
+    *p++ = static_cast<char>((v & 0x7f) | 0x80);
+  }
+  *p++ = static_cast<char>(v);
+  return p;
+}
+
+size_t messageSize(uint32_t floatCount, uint8_t const *bytes, 
+    uint32_t byteCount) noexcept
+{
+  size_t size{0};
+  for (uint32_t i{0}; i < floatCount; i++) {
+    size += varIntSize(key(i + 1, FOUR_BYTES)) + sizeof(float);
+  }
+  for (uint32_t i{0}; i < byteCount; i++) {
+    size += varIntSize(key(floatCount + i + 1, VARINT)) 
+      + varIntSize(bytes[i]);
+  }
+  return size;
+}
+
+size_t timeStampSize(cluon::data::TimeStamp const &timeStamp) noexcept
+{
+  return varIntSize(key(1, VARINT)) 
+    + varIntSize(toZigZag32(timeStamp.seconds())) 
+    + varIntSize(key(2, VARINT)) 
+    + varIntSize(toZigZag32(timeStamp.microseconds()));
+}
+
+size_t envelopeSize(EnvelopeFields const &fields, size_t messageSize) noexcept
+{
+  size_t size{varIntSize(key(1, VARINT)) 
+    + varIntSize(toZigZag32(fields.dataType)) 
+    + varIntSize(key(2, LENGTH_DELIMITED)) + varIntSize(messageSize) 
+    + messageSize};
+  for (auto [fieldId, timeStamp] : {std::make_pair(3U, &fields.sent), 
+      std::make_pair(4U, &fields.received), 
+      std::make_pair(5U, &fields.sampleTimeStamp)}) {
+    size_t const nestedSize{timeStampSize(*timeStamp)};
+    size += varIntSize(key(fieldId, LENGTH_DELIMITED)) 
+      + varIntSize(nestedSize) + nestedSize;
+  }
+  return size + varIntSize(key(6, VARINT)) + varIntSize(fields.senderStamp);
+}
+
+char *putTimeStamp(char *p, uint32_t fieldId, 
+    cluon::data::TimeStamp const &timeStamp) noexcept
+{
+  p = putVarInt(p, key(fieldId, LENGTH_DELIMITED));
+  p = putVarInt(p, timeStampSize(timeStamp));
+  p = putVarInt(p, key(1, VARINT));
+  p = putVarInt(p, toZigZag32(timeStamp.seconds()));
+  p = putVarInt(p, key(2, VARINT));
+  return putVarInt(p, toZigZag32(timeStamp.microseconds()));
+}
+
+}
+
+// Appends the OD4 frame of the Envelope with a message of float fields with
+// ids 1 to floatCount, followed by uint8 fields with the next ids, as its
+// serialized data. The bytes are the same as from cluon::ToProtoVisitor and
+// cluon::serializeEnvelope, but the sizes of the message and the Envelope
+// are found first, so that the header and all fields are written directly
+// into the output without any buffers in between.
+void appendReadingFrame(std::string &output, EnvelopeFields const &fields, 
+    float const *floats, uint32_t floatCount, uint8_t const *bytes, 
+    uint32_t byteCount)
+{
+  size_t const message{messageSize(floatCount, bytes, byteCount)};
+  size_t const envelope{envelopeSize(fields, message)};
+  size_t const offset{output.size()};
+  output.resize(offset + OD4_HEADER_SIZE + envelope);
+
+  char *p{&output[offset]};
+  *p++ = 0x0D;
+  *p++ = static_cast<char>(0xA4);
+  *p++ = static_cast<char>(envelope & 0xff);
+  *p++ = static_cast<char>((envelope >> 8) & 0xff);
+  *p++ = static_cast<char>((envelope >> 16) & 0xff);
+
+  p = putVarInt(p, key(1, VARINT));
+  p = putVarInt(p, toZigZag32(fields.dataType));
+  p = putVarInt(p, key(2, LENGTH_DELIMITED));
+  p = putVarInt(p, message);
+  for (uint32_t i{0}; i < floatCount; i++) {
+    p = putVarInt(p, key(i + 1, FOUR_BYTES));
+    uint32_t v;
+    std::memcpy(&v, &floats[i], sizeof(v));
+    v = htole32(v);
+    std::memcpy(p, &v, sizeof(v));
+    p += sizeof(v);
+  }
+  for (uint32_t i{0}; i < byteCount; i++) {
+    p = putVarInt(p, key(floatCount + i + 1, VARINT));
+    p = putVarInt(p, bytes[i]);
+  }
+  p = putTimeStamp(p, 3, fields.sent);
+  p = putTimeStamp(p, 4, fields.received);
+  p = putTimeStamp(p, 5, fields.sampleTimeStamp);
+  p = putVarInt(p, key(6, VARINT));
+  putVarInt(p, fields.senderStamp);
+}
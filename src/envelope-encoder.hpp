@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENVELOPE_ENCODER_HPP
+#define ENVELOPE_ENCODER_HPP
+
+#include "rec-file-view.hpp"
+
+#include <cstdint>
+#include <string>
+
+void appendReadingFrame(std::string &, EnvelopeFields const &, float const *, 
+    uint32_t, uint8_t const *, uint32_t);
+
+#endif
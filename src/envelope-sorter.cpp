@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "envelope-sorter.hpp"
+#include "output-sink.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <queue>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+OrderTracker::OrderTracker(uint64_t maxWindow) noexcept:
+  m_maxWindow{maxWindow},
+  m_records{},
+  m_firstRecord{0},
+  m_maxDroppedTimeStamp{0},
+  m_hasDroppedRecords{false},
+  m_count{0},
+  m_outOfOrderCount{0},
+  m_window{0}
+{
+}
+
+void OrderTracker::add(int64_t sampleTimeStamp)
+{
+  uint64_t const i{m_count++};
+
+  // Only the records of new maximum time stamps within the largest
+  // accepted window are kept. Dropped records are removed from the front
+  // once they are half of the vector, so that its memory is reused rather
+  // than allocated again for every few records as with a std::deque.
+  while (m_firstRecord < m_records.size() 
+      && m_records[m_firstRecord].second + m_maxWindow < i) {
+    m_maxDroppedTimeStamp = m_records[m_firstRecord].first;
+    m_hasDroppedRecords = true;
+    m_firstRecord++;
+  }
+  if (m_firstRecord > m_records.size() / 2) {
+    m_records.erase(m_records.begin(), m_records.begin() + m_firstRecord);
+    m_firstRecord = 0;
+  }
+
+  bool const isEmpty{m_firstRecord == m_records.size()};
+  int64_t const maxTimeStamp{isEmpty ? m_maxDroppedTimeStamp 
+    : m_records.back().first};
+  if ((isEmpty && !m_hasDroppedRecords) || sampleTimeStamp > maxTimeStamp) {
+    m_records.emplace_back(sampleTimeStamp, i);
+    return;
+  }
+  if (sampleTimeStamp == maxTimeStamp) {
+    return;
+  }
+
+  m_outOfOrderCount++;
+  if (m_hasDroppedRecords && sampleTimeStamp < m_maxDroppedTimeStamp) {
+    // The first later Envelope is further back than the largest window.
+    m_window = m_maxWindow + 1;
+    return;
+  }
+  auto firstLater{std::upper_bound(m_records.begin() + m_firstRecord, 
+      m_records.end(), sampleTimeStamp, [](int64_t t, auto const &record) { 
+        return t < record.first; 
+      })};
+  m_window = std::max(m_window, i - firstLater->second);
+}
+
+bool OrderTracker::isOrdered() const noexcept
+{
+  return m_outOfOrderCount == 0;
+}
+
+bool OrderTracker::fitsWindow() const noexcept
+{
+  return m_window <= m_maxWindow;
+}
+
+uint64_t OrderTracker::outOfOrderCount() const noexcept
+{
+  return m_outOfOrderCount;
+}
+
+uint64_t OrderTracker::window() const noexcept
+{
+  return m_window;
+}
+
+void reorderInWindow(RecFileView const &view, uint64_t window, 
+    std::function<void(std::string_view, EnvelopeSpan const &)> const &emit)
+{
+  struct Entry {
+    int64_t sampleTimeStamp;
+    uint64_t sequence;
+    uint64_t offset;
+  };
+  auto isLater{[](Entry const &a, Entry const &b) {
+      return a.sampleTimeStamp > b.sampleTimeStamp 
+        || (a.sampleTimeStamp == b.sampleTimeStamp && a.sequence > b.sequence);
+    }};
+  std::priority_queue<Entry, std::vector<Entry>, decltype(isLater)> 
+    heap(isLater);
+
+  EnvelopeSpan span;
+  auto emitEarliest{[&view, &heap, &span, &emit]() {
+      if (view.spanAt(heap.top().offset, span)) {
+        emit(view.frame(span), span);
+      }
+      heap.pop();
+    }};
+
+  uint64_t pos{0};
+  uint64_t sequence{0};
+  while (view.next(pos, span)) {
+    heap.push(Entry{span.sampleTimeStamp, sequence++, span.offset});
+    if (heap.size() > window) {
+      emitEarliest();
+    }
+  }
+  while (!heap.empty()) {
+    emitEarliest();
+  }
+}
+
+EnvelopeSorter::EnvelopeSorter(uint64_t memoryLimit, 
+    std::string const &tempDirectory):
+  m_memoryLimit{memoryLimit},
+  m_tempDirectory{tempDirectory},
+  m_runEntries{},
+  m_runBytes{0},
+  m_runFilenames{},
+  m_runViews{}
+{
+}
+
+EnvelopeSorter::~EnvelopeSorter()
+{
+  m_runViews.clear();
+  for (auto const &runFilename : m_runFilenames) {
+    std::remove(runFilename.c_str());
+  }
+}
+
+// Calls emit for each frame of the view, in ascending sampleTimeStamp
+// order. Returns false if a run could not be spilled to disk.
+//
+// The frames of a run are counted against the memory limit although they
+// are not copied, since they are read back in sorted order, i.e., at
+// random, and so need to stay in the page cache.
+bool EnvelopeSorter::sort(RecFileView const &view, Emitter const &emit)
+{
+  EnvelopeSpan span;
+  uint64_t pos{0};
+  while (view.next(pos, span)) {
+    uint64_t const memoryUsed{m_runBytes 
+      + (m_runEntries.size() + 1) * sizeof(Entry) + span.length};
+    if (memoryUsed > m_memoryLimit && !m_runEntries.empty()) {
+      if (!spillRun(view)) {
+        return false;
+      }
+    }
+    m_runEntries.push_back(Entry{span.sampleTimeStamp, span.offset, 
+        span.length});
+    m_runBytes += span.length;
+  }
+
+  if (m_runFilenames.empty()) {
+    // Everything fit in memory.
+    sortRun();
+    emitRun(view, emit);
+    return true;
+  }
+  if (!m_runEntries.empty() && !spillRun(view)) {
+    return false;
+  }
+  return mergeRuns(emit);
+}
+
+uint32_t EnvelopeSorter::runCount() const noexcept
+{
+  return static_cast<uint32_t>(m_runFilenames.size());
+}
+
+void EnvelopeSorter::sortRun()
+{
+  std::stable_sort(m_runEntries.begin(), m_runEntries.end(), 
+      [](Entry const &a, Entry const &b) { 
+        return a.sampleTimeStamp < b.sampleTimeStamp; 
+      });
+}
+
+// Writes the current run, sorted, as a .rec file of its own.
+bool EnvelopeSorter::spillRun(RecFileView const &view)
+{
+  sortRun();
+
+  std::string runFilename{(std::filesystem::path(m_tempDirectory) 
+      / "peak-reencode-run-XXXXXX").string()};
+  int fd{::mkstemp(runFilename.data())};
+  if (fd < 0) {
+    return false;
+  }
+  ::close(fd);
+  m_runFilenames.push_back(runFilename);
+
+  size_t const bufferSize{std::min<size_t>(m_runBytes, 8 * 1024 * 1024)};
+  OutputSink sink(runFilename, bufferSize, false);
+  for (auto const &entry : m_runEntries) {
+    sink.write(std::string_view(view.data() + entry.offset, entry.length));
+  }
+  m_runEntries.clear();
+  m_runBytes = 0;
+  return sink.close();
+}
+
+void EnvelopeSorter::emitRun(RecFileView const &view, 
+    Emitter const &emit) const
+{
+  EnvelopeSpan span;
+  for (auto const &entry : m_runEntries) {
+    if (view.spanAt(entry.offset, span)) {
+      emit(view.frame(span), span);
+    }
+  }
+}
+
+// K-way merge of the spilled runs. Each run is read sequentially, and ties
+// are broken by run number to keep the order of the recording.
+bool EnvelopeSorter::mergeRuns(Emitter const &emit)
+{
+  struct Cursor {
+    RecFileView const *view;
+    uint64_t pos;
+    EnvelopeSpan span;
+  };
+  std::vector<Cursor> cursors;
+  for (auto const &runFilename : m_runFilenames) {
+    m_runViews.push_back(std::make_unique<RecFileView>(runFilename));
+    if (!m_runViews.back()->isValid()) {
+      return false;
+    }
+    cursors.push_back(Cursor{m_runViews.back().get(), 0, EnvelopeSpan{}});
+  }
+
+  auto isLater{[&cursors](uint32_t a, uint32_t b) {
+      int64_t const aTime{cursors[a].span.sampleTimeStamp};
+      int64_t const bTime{cursors[b].span.sampleTimeStamp};
+      return aTime > bTime || (aTime == bTime && a > b);
+    }};
+  std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(isLater)> 
+    heap(isLater);
+  for (uint32_t i{0}; i < cursors.size(); i++) {
+    if (cursors[i].view->next(cursors[i].pos, cursors[i].span)) {
+      heap.push(i);
+    }
+  }
+
+  while (!heap.empty()) {
+    uint32_t const i{heap.top()};
+    heap.pop();
+    Cursor &cursor{cursors[i]};
+    emit(cursor.view->frame(cursor.span), cursor.span);
+    if (cursor.view->next(cursor.pos, cursor.span)) {
+      heap.push(i);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENVELOPE_SORTER_HPP
+#define ENVELOPE_SORTER_HPP
+
+#include "rec-file-view.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Detects if the sampleTimeStamps of a recording are already in order, and
+// if not, how far back out-of-order Envelopes need to be moved. For each
+// Envelope, the distance back to the first earlier Envelope with a later
+// time stamp is an upper bound on the number of Envelopes it needs to pass.
+class OrderTracker {
+ public:
+  OrderTracker(uint64_t) noexcept;
+  ~OrderTracker() = default;
+
+ public:
+  void add(int64_t);
+  bool isOrdered() const noexcept;
+  bool fitsWindow() const noexcept;
+  uint64_t outOfOrderCount() const noexcept;
+  uint64_t window() const noexcept;
+
+ private:
+  uint64_t const m_maxWindow;
+  std::vector<std::pair<int64_t, uint64_t>> m_records;
+  size_t m_firstRecord;
+  int64_t m_maxDroppedTimeStamp;
+  bool m_hasDroppedRecords;
+  uint64_t m_count;
+  uint64_t m_outOfOrderCount;
+  uint64_t m_window;
+};
+
+// Sorts a recording that is nearly in order, as found by OrderTracker, by
+// holding back a sliding window of Envelopes.
+void reorderInWindow(RecFileView const &, uint64_t, 
+    std::function<void(std::string_view, EnvelopeSpan const &)> const &);
+
+// Sorts the frames of a recording by sampleTimeStamp in bounded memory.
+// Sorted runs that do not fit in memory are spilled to temporary files,
+// which are then merged sequentially. Frames with equal time stamps keep
+// their order from the recording, as with cluon::Player. A run is only a
+// list of offsets into the recording, so that the frames are not copied
+// when all fit in one run, and are emitted from the recording itself. The
+// emitted frames stay valid until the sorter and the recording are
+// destroyed.
+class EnvelopeSorter {
+ public:
+  using Emitter = std::function<void(std::string_view, EnvelopeSpan const &)>;
+
+ private:
+  struct Entry {
+    int64_t sampleTimeStamp;
+    uint64_t offset;
+    uint32_t length;
+  };
+
+ public:
+  EnvelopeSorter(uint64_t, std::string const &);
+  ~EnvelopeSorter();
+
+ private:
+  EnvelopeSorter(EnvelopeSorter const &) = delete;
+  EnvelopeSorter(EnvelopeSorter &&) = delete;
+  EnvelopeSorter &operator=(EnvelopeSorter const &) = delete;
+  EnvelopeSorter &operator=(EnvelopeSorter &&) = delete;
+
+ public:
+  bool sort(RecFileView const &, Emitter const &);
+  uint32_t runCount() const noexcept;
+
+ private:
+  void sortRun();
+  bool spillRun(RecFileView const &);
+  void emitRun(RecFileView const &, Emitter const &) const;
+  bool mergeRuns(Emitter const &);
+
+ private:
+  uint64_t const m_memoryLimit;
+  std::string const m_tempDirectory;
+  std::vector<Entry> m_runEntries;
+  uint64_t m_runBytes;
+  std::vector<std::string> m_runFilenames;
+  std::vector<std::unique_ptr<RecFileView>> m_runViews;
+};
+
+#endif
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "message-schemas.hpp"
+
+#include "envelope-transformer.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <endian.h>
+
+namespace {
+
+size_t const MAX_BATCH_SIZE{1024 * 1024};
+size_t const MAX_BATCHED_FRAME_SIZE{64 * 1024};
+size_t const MAX_BATCHED_FLOATS{3 * 4096};
+
+float readFloat(char const *p) noexcept
+{
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  v = le32toh(v);
+  float f;
+  std::memcpy(&f, &v, sizeof(f));
+  return f;
+}
+
+void writeFloat(char *p, float f) noexcept
+{
+  uint32_t v;
+  std::memcpy(&v, &f, sizeof(v));
+  v = htole32(v);
+  std::memcpy(p, &v, sizeof(v));
+}
+
+// Checks the keys of float fields 1 to count at the offsets where cluon
+// encodes them, which are then the ones that locateFloatFields() finds.
+bool locateSchemaFloatFields(std::string_view serializedData, 
+    uint32_t *offsets, uint32_t count) noexcept
+{
+  if (serializedData.size() < 5 * count) {
+    return false;
+  }
+  for (uint32_t i{0}; i < count; i++) {
+    if (static_cast<uint8_t>(serializedData[5 * i]) != (((i + 1) << 3) | 5)) {
+      return false;
+    }
+    offsets[i] = 5 * i + 1;
+  }
+  return true;
+}
+
+}
+
+EnvelopeTransformer::EnvelopeTransformer(
+    Classification const &classification, CorrectionRules const &rules):
+  m_handlerSlots{},
+  m_handlers{},
+  m_handlerCount{0},
+  m_corrections{},
+  m_floatBatchCount{0},
+  m_indexer{},
+  m_stats{nullptr},
+  m_envelopeCount{0},
+  m_writtenBytes{0},
+  m_batch{},
+  m_dedupState{},
+  m_skippedCounts{}
+{
+  for (auto const &rule : rules) {
+    auto holds{[&classification](RuleCondition condition) {
+        return conditionHolds(condition, classification);
+      }};
+    ReadingLayout const layout{readingLayout(rule.dataType)};
+    Handler h{};
+    h.rule = &rule;
+    h.isRemoved = holds(rule.remove);
+    h.floatCount = rule.floatCount;
+    h.byteCount = rule.byteCount;
+    h.hasSchemaOffsets = layout.isReading 
+      && layout.floatCount == rule.floatCount;
+    bool const hasMinAbs{holds(rule.minAbs)};
+    h.minAbs = rule.minAbsValue;
+    h.hasOutlierRatio = holds(rule.outlier);
+    h.outlierRatio = rule.outlierRatio;
+    h.isDeduplicated = holds(rule.dedup);
+    switch (rule.floatCount) {
+      case 1:
+        h.keep = keepFunction<1>(hasMinAbs, h.hasOutlierRatio, 
+            h.isDeduplicated);
+        break;
+      case 2:
+        h.keep = keepFunction<2>(hasMinAbs, h.hasOutlierRatio, 
+            h.isDeduplicated);
+        break;
+      case 3:
+        h.keep = keepFunction<3>(hasMinAbs, h.hasOutlierRatio, 
+            h.isDeduplicated);
+        break;
+      default:
+        break;
+    }
+
+    FloatCorrection const correction{holds(rule.scale), rule.factor, 
+      holds(rule.thresholdOffset), rule.threshold, rule.offset};
+    if (correction.scale || correction.correct) {
+      m_corrections[m_floatBatchCount] = correction;
+      h.floatBatch = m_floatBatchCount++;
+    }
+
+    if (h.isRemoved || h.keep != nullptr || h.floatBatch != NO_FLOAT_BATCH) {
+      registerHandler(rule.dataType, h);
+    }
+  }
+}
+
+// Adds the handler of a message type. Envelopes of all other types are
+// passed through as they are, without being decoded. There are at most as
+// many handlers, and so float batches, as rules.
+void EnvelopeTransformer::registerHandler(int32_t dataType, 
+    Handler const &handler)
+{
+  if (dataType <= 0 || static_cast<size_t>(dataType) >= HANDLER_SLOTS
+      || m_handlerCount == MAX_HANDLERS) {
+    throw std::out_of_range("No handler slot for message type " 
+        + std::to_string(dataType));
+  }
+  m_handlers[m_handlerCount++] = handler;
+  m_handlerSlots[static_cast<size_t>(dataType)] = 
+    static_cast<uint8_t>(m_handlerCount);
+}
+
+// Finds the handler of a message type with a single table lookup, or
+// returns nullptr if the type is passed through.
+EnvelopeTransformer::Handler const *EnvelopeTransformer::handler(
+    int32_t dataType) const noexcept
+{
+  if (dataType <= 0 || static_cast<size_t>(dataType) >= HANDLER_SLOTS) {
+    return nullptr;
+  }
+  uint8_t const slot{m_handlerSlots[static_cast<size_t>(dataType)]};
+  return (slot == 0) ? nullptr : &m_handlers[slot - 1];
+}
+
+// Returns true if Envelopes of the given type may be changed or removed,
+// all other Envelopes can be passed through as they are.
+bool EnvelopeTransformer::handles(int32_t dataType) const noexcept
+{
+  return handler(dataType) != nullptr;
+}
+
+// Adds the transformed frame, if it is to be kept, to the current batch.
+// Frames that are passed through unchanged and are too large to be worth
+// batching end the batch without being copied, and so must stay valid
+// until the batch is written.
+void EnvelopeTransformer::push(std::string_view frame, 
+    EnvelopeSpan const &span, BatchConsumer const &consume)
+{
+  m_envelopeCount++;
+  Handler const *h{handler(span.dataType)};
+  if (h == nullptr) {
+    if (frame.size() > MAX_BATCHED_FRAME_SIZE) {
+      addToIndex(m_writtenBytes + m_batch.frames.size(), 
+          static_cast<uint32_t>(frame.size()), span);
+      m_batch.largeFrame = frame;
+      flush(consume);
+    } else {
+      addToBatch(frame, span);
+    }
+  } else if (!h->isRemoved) {
+    // Kept frames are copied as they are, with any corrected floats written
+    // over them later, unless their float fields are not all where 
+    // expected.
+    std::string_view const serializedData{frame.substr(
+        span.serializedDataOffset, span.serializedDataLength)};
+    uint32_t const fieldIds[MAX_FLOAT_FIELDS]{1, 2, 3};
+    uint32_t offsets[MAX_FLOAT_FIELDS];
+    if ((h->hasSchemaOffsets && locateSchemaFloatFields(serializedData, 
+            offsets, h->floatCount)) 
+        || locateFloatFields(serializedData, fieldIds, offsets, 
+          h->floatCount)) {
+      pushFloatFields(frame, span, offsets, *h);
+    } else {
+      transformAndEncode(frame, span, *h);
+    }
+  }
+
+  if (m_batch.frames.size() > MAX_BATCH_SIZE || (h != nullptr 
+        && h->floatBatch != NO_FLOAT_BATCH 
+        && m_batch.floatBatches[h->floatBatch].values.size() 
+        >= MAX_BATCHED_FLOATS)) {
+    flush(consume);
+  }
+}
+
+// Gives the current batch, if not empty, to the consumer.
+void EnvelopeTransformer::flush(BatchConsumer const &consume)
+{
+  uint64_t const size{m_batch.frames.size() + m_batch.largeFrame.size()};
+  if (size > 0) {
+    m_writtenBytes += size;
+    consume(m_batch);
+    reserveBatch(m_batch);
+  }
+}
+
+// Corrects all gathered float fields of the batch. Only reads the state
+// set up by the constructor, so batches can be corrected concurrently with
+// calls to push().
+void EnvelopeTransformer::correctBatch(Batch &batch) const noexcept
+{
+  StageTimer timer(m_stats, Stage::Correct);
+  for (size_t i{0}; i < m_floatBatchCount; i++) {
+    FloatBatch &floatBatch{batch.floatBatches[i]};
+    correctFloats(floatBatch.values.data(), floatBatch.values.size(), 
+        m_corrections[i]);
+    for (size_t j{0}; j < floatBatch.values.size(); j++) {
+      writeFloat(batch.frames.data() + floatBatch.positions[j], 
+          floatBatch.values[j]);
+    }
+  }
+}
+
+// Corrects and writes the batch, and empties it for reuse.
+void EnvelopeTransformer::writeBatch(Batch &batch, OutputSink &sink) const 
+  noexcept
+{
+  correctBatch(batch);
+  {
+    StageTimer timer(m_stats, Stage::Write);
+    sink.write(batch.frames);
+    if (!batch.largeFrame.empty()) {
+      sink.write(batch.largeFrame);
+    }
+  }
+  clearBatch(batch);
+}
+
+// Corrects the batch and appends it to the given output, which is then
+// written by the caller.
+void EnvelopeTransformer::writeBatch(Batch &batch, std::string &output) const
+{
+  correctBatch(batch);
+  output.append(batch.frames);
+  output.append(batch.largeFrame);
+  clearBatch(batch);
+}
+
+// Makes room for a full batch, so that batches taken in exchange by a 
+// consumer are not grown piece by piece while they are filled.
+void EnvelopeTransformer::reserveBatch(Batch &batch) const
+{
+  batch.frames.reserve(MAX_BATCH_SIZE + MAX_BATCHED_FRAME_SIZE);
+  for (size_t i{0}; i < m_floatBatchCount; i++) {
+    batch.floatBatches[i].values.reserve(MAX_BATCHED_FLOATS);
+    batch.floatBatches[i].positions.reserve(MAX_BATCHED_FLOATS);
+  }
+}
+
+void EnvelopeTransformer::clearBatch(Batch &batch) noexcept
+{
+  batch.frames.clear();
+  for (auto &floatBatch : batch.floatBatches) {
+    floatBatch.values.clear();
+    floatBatch.positions.clear();
+  }
+  batch.largeFrame = std::string_view{};
+}
+
+// If set, an index entry is added for every written frame. Since the
+// Envelopes are given in sampleTimeStamp order, so are the entries.
+void EnvelopeTransformer::setIndexer(Indexer indexer)
+{
+  m_indexer = std::move(indexer);
+}
+
+// If set, the time spent correcting and writing batches is added to the
+// stats, also by transformers of other parts of the same recording.
+void EnvelopeTransformer::setStats(FileStats *stats) noexcept
+{
+  m_stats = stats;
+}
+
+FileStats *EnvelopeTransformer::stats() const noexcept
+{
+  return m_stats;
+}
+
+// The number of Envelopes given to push(), including the ones added from
+// other transformers.
+uint64_t EnvelopeTransformer::envelopeCount() const noexcept
+{
+  return m_envelopeCount;
+}
+
+EnvelopeTransformer::DedupState EnvelopeTransformer::dedupState() const 
+  noexcept
+{
+  return m_dedupState;
+}
+
+void EnvelopeTransformer::setDedupState(DedupState const &state) noexcept
+{
+  m_dedupState = state;
+}
+
+// Total size of the frames kept so far, including the ones in the current
+// batch. Grows with each call to push() that keeps its frame.
+uint64_t EnvelopeTransformer::outputSize() const noexcept
+{
+  return m_writtenBytes + m_batch.frames.size() + m_batch.largeFrame.size();
+}
+
+void EnvelopeTransformer::addToIndex(uint64_t offset, uint32_t length, 
+    EnvelopeSpan const &span)
+{
+  if (m_indexer) {
+    m_indexer(IndexEntry{span.sampleTimeStamp, offset, length, 
+        span.dataType, span.senderStamp});
+  }
+}
+
+void EnvelopeTransformer::addToBatch(std::string_view frame, 
+    EnvelopeSpan const &span)
+{
+  addToIndex(m_writtenBytes + m_batch.frames.size(), 
+      static_cast<uint32_t>(frame.size()), span);
+  m_batch.frames.append(frame);
+}
+
+// Appends the frame to the batch if it is to be kept. Its float fields are
+// gathered, if they need to be corrected, to be corrected in the same way
+// as by the handler once the batch is flushed.
+void EnvelopeTransformer::pushFloatFields(std::string_view frame, 
+    EnvelopeSpan const &span, uint32_t const *offsets, Handler const &h)
+{
+  float v[MAX_FLOAT_FIELDS];
+  for (uint32_t i{0}; i < h.floatCount; i++) {
+    v[i] = readFloat(frame.data() + span.serializedDataOffset + offsets[i]);
+  }
+
+  if (h.keep != nullptr && !(this->*h.keep)(h, v)) {
+    return;
+  }
+
+  if (h.floatBatch != NO_FLOAT_BATCH) {
+    FloatBatch &floatBatch{m_batch.floatBatches[h.floatBatch]};
+    size_t const framePosition{m_batch.frames.size() 
+      + span.serializedDataOffset};
+    for (uint32_t i{0}; i < h.floatCount; i++) {
+      floatBatch.values.push_back(v[i]);
+      floatBatch.positions.push_back(framePosition + offsets[i]);
+    }
+  }
+  addToBatch(frame, span);
+}
+
+// Decodes the message of the frame, transforms it, and adds the encoded
+// frame to the batch if it is to be kept. The message is decoded directly
+// from the bytes of the frame and encoded directly into the batch, so that
+// no memory is allocated. Only an Envelope that cluon would decode differently
+// is decoded by cluon.
+void EnvelopeTransformer::transformAndEncode(std::string_view frame, 
+    EnvelopeSpan const &span, Handler const &h)
+{
+  EnvelopeFields fields;
+  std::string serializedData;
+  if (!decodeEnvelopeFields(frame, fields)) {
+    cluon::data::Envelope e{decodeEnvelope(frame)};
+    serializedData = e.serializedData();
+    fields.dataType = e.dataType();
+    fields.serializedData = serializedData;
+    fields.sent = e.sent();
+    fields.received = e.received();
+    fields.sampleTimeStamp = e.sampleTimeStamp();
+    fields.senderStamp = e.senderStamp();
+  }
+
+  float v[MAX_FLOAT_FIELDS];
+  uint8_t bytes[MAX_BYTE_FIELDS];
+  decodeReadingFields(fields.serializedData, v, h.floatCount, bytes, 
+      h.byteCount);
+
+  if (h.keep != nullptr && !(this->*h.keep)(h, v)) {
+    return;
+  }
+  if (h.floatBatch != NO_FLOAT_BATCH) {
+    correctFloats(v, h.floatCount, m_corrections[h.floatBatch]);
+  }
+
+  size_t const offset{m_batch.frames.size()};
+  appendReadingFrame(m_batch.frames, fields, v, h.floatCount, bytes, 
+      h.byteCount);
+  addToIndex(m_writtenBytes + offset, 
+      static_cast<uint32_t>(m_batch.frames.size() - offset), span);
+}
+
+// Returns false if the reading should be removed by the given checks of
+// its handler, in the order of the rules. Readings too close to zero are
+// not counted as skipped, and are not compared against.
+template <uint32_t FLOATS, bool MIN_ABS, bool OUTLIER, bool DEDUP>
+bool EnvelopeTransformer::keepReading(Handler const &h, float const *v) 
+  noexcept
+{
+  size_t const i{static_cast<size_t>(&h - m_handlers.data())};
+  double x[FLOATS];
+  for (uint32_t j{0}; j < FLOATS; j++) {
+    x[j] = v[j];
+    if constexpr (MIN_ABS) {
+      if (std::abs(x[j]) < h.minAbs) {
+        return false;
+      }
+    }
+  }
+
+  KeptReading &kept{m_dedupState.readings[i]};
+  if constexpr (OUTLIER || DEDUP) {
+    if (kept.isFound) {
+      for (uint32_t j{0}; j < FLOATS; j++) {
+        if ((OUTLIER && kept.values[j] - x[j] 
+              > h.outlierRatio * std::abs(kept.values[j]))
+            || (DEDUP && ::memcmp(&x[j], &kept.values[j], 8) == 0)) {
+          m_skippedCounts[i]++;
+          return false;
+        }
+      }
+    }
+  }
+  kept.isFound = true;
+  for (uint32_t j{0}; j < FLOATS; j++) {
+    kept.values[j] = x[j];
+  }
+  return true;
+}
+
+// The instantiation of keepReading() for the given checks, or nullptr if
+// there are none.
+template <uint32_t FLOATS>
+EnvelopeTransformer::KeepFunction EnvelopeTransformer::keepFunction(
+    bool hasMinAbs, bool hasOutlierRatio, bool isDeduplicated) noexcept
+{
+  KeepFunction const functions[2][2][2]{
+    {{nullptr, &EnvelopeTransformer::keepReading<FLOATS, false, false, true>}, 
+      {&EnvelopeTransformer::keepReading<FLOATS, false, true, false>, 
+        &EnvelopeTransformer::keepReading<FLOATS, false, true, true>}}, 
+    {{&EnvelopeTransformer::keepReading<FLOATS, true, false, false>, 
+       &EnvelopeTransformer::keepReading<FLOATS, true, false, true>}, 
+      {&EnvelopeTransformer::keepReading<FLOATS, true, true, false>, 
+        &EnvelopeTransformer::keepReading<FLOATS, true, true, true>}}};
+  return functions[hasMinAbs][hasOutlierRatio][isDeduplicated];
+}
+
+// Adds the skipped readings and the Envelopes of another transformer, of
+// the same rules and classification, which handled another part of the 
+// same recording.
+void EnvelopeTransformer::addSummary(EnvelopeTransformer const &other) 
+  noexcept
+{
+  m_envelopeCount += other.m_envelopeCount;
+  for (size_t i{0}; i < m_handlerCount; i++) {
+    m_skippedCounts[i] += other.m_skippedCounts[i];
+  }
+}
+
+void EnvelopeTransformer::printSummary(std::ostream &log) const
+{
+  for (size_t i{0}; i < m_handlerCount; i++) {
+    Handler const &h{m_handlers[i]};
+    if (h.hasOutlierRatio || h.isDeduplicated) {
+      log << "..skipped " << m_skippedCounts[i] << " duplicated " 
+        << (h.hasOutlierRatio ? "or invalid " : "") << h.rule->name << "s" 
+        << std::endl;
+    }
+  }
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENVELOPE_TRANSFORMER_HPP
+#define ENVELOPE_TRANSFORMER_HPP
+
+#include "cluon-complete.hpp"
+
+#include "classifier.hpp"
+#include "correction-rules.hpp"
+#include "envelope-encoder.hpp"
+#include "float-kernels.hpp"
+#include "output-sink.hpp"
+#include "rec-file-view.hpp"
+#include "rec-index.hpp"
+#include "stage-stats.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Applies the CorrectionRules that hold for a Classification to the
+// Envelopes of a recording. The Envelopes must be given in ascending 
+// sampleTimeStamp order since duplicated and invalid readings are detected
+// against the previously kept reading of the same type.
+//
+// Output frames are collected in a Batch. The float fields to be corrected
+// in the batch are gathered into one array per message type, to be 
+// corrected together by correctBatch() and scattered back before the batch
+// is written. Full batches are given to a BatchConsumer, which may correct
+// and write them on another thread.
+class EnvelopeTransformer {
+ private:
+  // Handlers are looked up by message type in a flat table of slots, which
+  // covers all types that rules can be given for.
+  static constexpr size_t HANDLER_SLOTS{MAX_RULE_DATA_TYPE + 1};
+  static constexpr size_t MAX_HANDLERS{MAX_MESSAGE_RULES};
+  static constexpr uint32_t MAX_FLOAT_FIELDS{MAX_RULE_FLOATS};
+  static constexpr uint32_t MAX_BYTE_FIELDS{MAX_RULE_BYTES};
+  static constexpr size_t NO_FLOAT_BATCH{MAX_HANDLERS};
+
+ public:
+  struct FloatBatch {
+    std::vector<float> values{};
+    std::vector<size_t> positions{};
+  };
+
+  // Frames to be written in order, followed by a frame too large to be
+  // worth copying into the batch, if any.
+  struct Batch {
+    std::string frames{};
+    std::array<FloatBatch, MAX_HANDLERS> floatBatches{};
+    std::string_view largeFrame{};
+  };
+
+  // Takes the contents of a full batch, and leaves it empty to be refilled.
+  using BatchConsumer = std::function<void(Batch &)>;
+
+  // Receives an index entry for every frame added to the output.
+  using Indexer = std::function<void(IndexEntry const &)>;
+
+  // The previously kept reading of each handled type, that duplicated and
+  // invalid readings are detected against, to be carried from one part of
+  // a recording to the next when the parts are transformed separately by
+  // transformers of the same rules and classification.
+  struct KeptReading {
+    bool isFound{false};
+    double values[MAX_FLOAT_FIELDS]{};
+  };
+  struct DedupState {
+    std::array<KeptReading, MAX_HANDLERS> readings{};
+  };
+
+ private:
+  struct Handler;
+  using KeepFunction = bool (EnvelopeTransformer::*)(Handler const &, 
+      float const *) noexcept;
+
+  // The rules of one message type, compiled for the classification. Only
+  // rules that hold are set, and types without any are passed through. 
+  // Readings are checked by the instantiation of keepReading() for their
+  // checks, if any. Kept readings are copied as they are, with their floats
+  // corrected in their float batch, if any. The floats are looked for at
+  // the offsets given by the schema of the message, if known, and then by
+  // decoding the keys. If not all found, the reading is decoded, corrected,
+  // and encoded again.
+  struct Handler {
+    MessageRule const *rule{nullptr};
+    bool isRemoved{false};
+    uint32_t floatCount{0};
+    uint32_t byteCount{0};
+    bool hasSchemaOffsets{false};
+    KeepFunction keep{nullptr};
+    double minAbs{0.0};
+    bool hasOutlierRatio{false};
+    double outlierRatio{0.0};
+    bool isDeduplicated{false};
+    size_t floatBatch{NO_FLOAT_BATCH};
+  };
+
+ private:
+  EnvelopeTransformer(EnvelopeTransformer const &) = delete;
+  EnvelopeTransformer(EnvelopeTransformer &&) = delete;
+  EnvelopeTransformer &operator=(EnvelopeTransformer const &) = delete;
+  EnvelopeTransformer &operator=(EnvelopeTransformer &&) = delete;
+
+ public:
+  EnvelopeTransformer(Classification const &, CorrectionRules const &);
+  ~EnvelopeTransformer() = default;
+
+ public:
+  bool handles(int32_t) const noexcept;
+  void setIndexer(Indexer);
+  void setStats(FileStats *) noexcept;
+  FileStats *stats() const noexcept;
+  uint64_t envelopeCount() const noexcept;
+  DedupState dedupState() const noexcept;
+  void setDedupState(DedupState const &) noexcept;
+  uint64_t outputSize() const noexcept;
+  void push(std::string_view, EnvelopeSpan const &, BatchConsumer const &);
+  void flush(BatchConsumer const &);
+  void correctBatch(Batch &) const noexcept;
+  void writeBatch(Batch &, OutputSink &) const noexcept;
+  void writeBatch(Batch &, std::string &) const;
+  void addSummary(EnvelopeTransformer const &) noexcept;
+  void printSummary(std::ostream &) const;
+
+ private:
+  void registerHandler(int32_t, Handler const &);
+  Handler const *handler(int32_t) const noexcept;
+  void reserveBatch(Batch &) const;
+  static void clearBatch(Batch &) noexcept;
+  void transformAndEncode(std::string_view, EnvelopeSpan const &, 
+      Handler const &);
+  template <uint32_t FLOATS, bool MIN_ABS, bool OUTLIER, bool DEDUP>
+  bool keepReading(Handler const &, float const *) noexcept;
+  template <uint32_t FLOATS>
+  static KeepFunction keepFunction(bool, bool, bool) noexcept;
+  void addToIndex(uint64_t, uint32_t, EnvelopeSpan const &);
+  void addToBatch(std::string_view, EnvelopeSpan const &);
+  void pushFloatFields(std::string_view, EnvelopeSpan const &, 
+      uint32_t const *, Handler const &);
+
+ private:
+  std::array<uint8_t, HANDLER_SLOTS> m_handlerSlots;
+  std::array<Handler, MAX_HANDLERS> m_handlers;
+  size_t m_handlerCount;
+  std::array<FloatCorrection, MAX_HANDLERS> m_corrections;
+  size_t m_floatBatchCount;
+  Indexer m_indexer;
+  FileStats *m_stats;
+  uint64_t m_envelopeCount;
+  uint64_t m_writtenBytes;
+  Batch m_batch;
+  DedupState m_dedupState;
+  std::array<uint32_t, MAX_HANDLERS> m_skippedCounts;
+};
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file-copy.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t COPY_CHUNK_SIZE{1024 * 1024 * 1024};
+constexpr size_t READ_WRITE_BUFFER_SIZE{8 * 1024 * 1024};
+
+// The errors telling that a method is not supported for the given files, so
+// that the next one should be tried.
+bool isUnsupported(int error) noexcept
+{
+  return error == EXDEV || error == ENOSYS || error == EINVAL 
+    || error == EOPNOTSUPP || error == ENOTTY || error == EBADF 
+    || error == EPERM;
+}
+
+// Copies with the given in-kernel call until the end of the file. Returns
+// 1 if done, 0 if unsupported before anything was copied, and -1 on errors.
+template <typename CopyCall>
+int32_t copyInKernel(uint64_t size, CopyCall copy) noexcept
+{
+  uint64_t copied{0};
+  while (copied < size) {
+    size_t const chunk{static_cast<size_t>(
+        std::min<uint64_t>(size - copied, COPY_CHUNK_SIZE))};
+    ssize_t const n{copy(chunk)};
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return (copied == 0 && isUnsupported(errno)) ? 0 : -1;
+    }
+    if (n == 0) {
+      // The input file was truncated while copying.
+      return -1;
+    }
+    copied += static_cast<uint64_t>(n);
+  }
+  return 1;
+}
+
+bool copyReadWrite(int inFd, int outFd) noexcept
+{
+  std::vector<char> buffer(READ_WRITE_BUFFER_SIZE);
+  while (true) {
+    ssize_t const n{::read(inFd, buffer.data(), buffer.size())};
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (n == 0) {
+      return true;
+    }
+    char const *p{buffer.data()};
+    size_t left{static_cast<size_t>(n)};
+    while (left > 0) {
+      ssize_t const written{::write(outFd, p, left)};
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      p += written;
+      left -= static_cast<size_t>(written);
+    }
+  }
+}
+
+bool copyFile(int inFd, int outFd, uint64_t size, CopyMethod &method) 
+  noexcept
+{
+#ifdef FICLONE
+  if (::ioctl(outFd, FICLONE, inFd) == 0) {
+    method = CopyMethod::Reflink;
+    return true;
+  }
+#endif
+
+  int32_t done{copyInKernel(size, [inFd, outFd](size_t chunk) {
+        return ::copy_file_range(inFd, nullptr, outFd, nullptr, chunk, 0);
+      })};
+  if (done != 0) {
+    method = CopyMethod::CopyFileRange;
+    return done > 0;
+  }
+
+  done = copyInKernel(size, [inFd, outFd](size_t chunk) {
+      return ::sendfile(outFd, inFd, nullptr, chunk);
+    });
+  if (done != 0) {
+    method = CopyMethod::Sendfile;
+    return done > 0;
+  }
+
+  method = CopyMethod::ReadWrite;
+  return copyReadWrite(inFd, outFd);
+}
+
+}
+
+char const *copyMethodName(CopyMethod method) noexcept
+{
+  switch (method) {
+    case CopyMethod::Hardlink:
+      return "a hard link";
+    case CopyMethod::Reflink:
+      return "a reflink";
+    case CopyMethod::CopyFileRange:
+      return "copy_file_range";
+    case CopyMethod::Sendfile:
+      return "sendfile";
+    case CopyMethod::ReadWrite:
+      return "read and write";
+  }
+  return "unknown";
+}
+
+bool copyUnchangedFile(std::string const &inFilename, 
+    std::string const &outFilename, bool allowHardlink, bool fsyncOnClose, 
+    CopyMethod &method) noexcept
+{
+  if (allowHardlink && ::link(inFilename.c_str(), outFilename.c_str()) == 0) {
+    method = CopyMethod::Hardlink;
+    return true;
+  }
+
+  int inFd{::open(inFilename.c_str(), O_RDONLY)};
+  if (inFd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (::fstat(inFd, &st) != 0) {
+    ::close(inFd);
+    return false;
+  }
+  int outFd{::open(outFilename.c_str(), O_WRONLY | O_CREAT | O_EXCL, 
+      st.st_mode & 0777)};
+  if (outFd < 0) {
+    ::close(inFd);
+    return false;
+  }
+
+  bool ok{copyFile(inFd, outFd, static_cast<uint64_t>(st.st_size), method)};
+  if (ok && fsyncOnClose && ::fsync(outFd) != 0) {
+    ok = false;
+  }
+  ::close(inFd);
+  if (::close(outFd) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    ::unlink(outFilename.c_str());
+  }
+  return ok;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_COPY_HPP
+#define FILE_COPY_HPP
+
+#include <string>
+
+// The ways a file can be copied, from the cheapest to the most expensive.
+enum class CopyMethod {
+  Hardlink,
+  Reflink,
+  CopyFileRange,
+  Sendfile,
+  ReadWrite
+};
+
+char const *copyMethodName(CopyMethod) noexcept;
+
+// Copies a file that is kept unchanged, using the cheapest method the file
+// system supports. A hard link is only made if allowed, since the output
+// then shares its data and metadata with the input. The output file must
+// not exist. Returns false, and removes any partial output, on failure.
+bool copyUnchangedFile(std::string const &, std::string const &, bool, bool, 
+    CopyMethod &) noexcept;
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "float-kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+namespace {
+
+// The kernels are instantiated for each combination of the scale and
+// correct flags, so that their loops do not test them.
+template <bool SCALE, bool CORRECT>
+void correctFloatsScalar(float *v, size_t n, 
+    FloatCorrection const &c) noexcept
+{
+  for (size_t i{0}; i < n; i++) {
+    float x = v[i];
+    if constexpr (SCALE) {
+      x = x * c.factor;
+    }
+    if constexpr (CORRECT) {
+      if (x > c.threshold) {
+        x -= c.offset;
+      }
+    }
+    v[i] = x;
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+// The correction is done with a blend rather than by subtracting a masked
+// offset, so that values not above the threshold are kept bit by bit, as
+// in the scalar version.
+template <bool SCALE, bool CORRECT>
+__attribute__((target("sse2")))
+void correctFloatsSse(float *v, size_t n, FloatCorrection const &c) noexcept
+{
+  __m128 const factor{_mm_set1_ps(c.factor)};
+  __m128 const threshold{_mm_set1_ps(c.threshold)};
+  __m128 const offset{_mm_set1_ps(c.offset)};
+  size_t i{0};
+  for (; i + 4 <= n; i += 4) {
+    __m128 x{_mm_loadu_ps(v + i)};
+    if constexpr (SCALE) {
+      x = _mm_mul_ps(x, factor);
+    }
+    if constexpr (CORRECT) {
+      __m128 const mask{_mm_cmpgt_ps(x, threshold)};
+      x = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(x, offset)), 
+          _mm_andnot_ps(mask, x));
+    }
+    _mm_storeu_ps(v + i, x);
+  }
+  correctFloatsScalar<SCALE, CORRECT>(v + i, n - i, c);
+}
+
+template <bool SCALE, bool CORRECT>
+__attribute__((target("avx2")))
+void correctFloatsAvx2(float *v, size_t n, FloatCorrection const &c) noexcept
+{
+  __m256 const factor{_mm256_set1_ps(c.factor)};
+  __m256 const threshold{_mm256_set1_ps(c.threshold)};
+  __m256 const offset{_mm256_set1_ps(c.offset)};
+  size_t i{0};
+  for (; i + 8 <= n; i += 8) {
+    __m256 x{_mm256_loadu_ps(v + i)};
+    if constexpr (SCALE) {
+      x = _mm256_mul_ps(x, factor);
+    }
+    if constexpr (CORRECT) {
+      __m256 const mask{_mm256_cmp_ps(x, threshold, _CMP_GT_OQ)};
+      x = _mm256_blendv_ps(x, _mm256_sub_ps(x, offset), mask);
+    }
+    _mm256_storeu_ps(v + i, x);
+  }
+  correctFloatsScalar<SCALE, CORRECT>(v + i, n - i, c);
+}
+#endif
+
+using Kernel = void (*)(float *, size_t, FloatCorrection const &) noexcept;
+
+// The kernels of one instruction set, indexed by the scale and correct
+// flags, of which at least one is set.
+struct KernelChoice {
+  Kernel kernels[2][2];
+  char const *name;
+};
+
+// The best kernel for the running CPU, chosen once.
+KernelChoice const &kernelChoice() noexcept
+{
+  static KernelChoice const choice{[]() -> KernelChoice {
+#ifdef HAVE_X86_KERNELS
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+        return {{{nullptr, correctFloatsAvx2<false, true>}, 
+          {correctFloatsAvx2<true, false>, correctFloatsAvx2<true, true>}}, 
+          "avx2"};
+      }
+      if (__builtin_cpu_supports("sse2")) {
+        return {{{nullptr, correctFloatsSse<false, true>}, 
+          {correctFloatsSse<true, false>, correctFloatsSse<true, true>}}, 
+          "sse2"};
+      }
+#endif
+      return {{{nullptr, correctFloatsScalar<false, true>}, 
+        {correctFloatsScalar<true, false>, correctFloatsScalar<true, true>}}, 
+        "scalar"};
+    }()};
+  return choice;
+}
+
+}
+
+void correctFloats(float *v, size_t n, FloatCorrection const &c) noexcept
+{
+  if (!c.scale && !c.correct) {
+    return;
+  }
+  kernelChoice().kernels[c.scale][c.correct](v, n, c);
+}
+
+char const *floatKernelName() noexcept
+{
+  return kernelChoice().name;
+}
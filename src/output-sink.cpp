@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output-sink.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// The file is only opened once the buffer is allocated, so that it is not
+// left open if the allocation throws.
+OutputSink::OutputSink(std::string const &filename, size_t bufferSize, 
+    bool fsyncOnClose):
+  m_fd{-1},
+  m_buffer(bufferSize),
+  m_bufferUsed{0},
+  m_size{0},
+  m_fsyncOnClose{fsyncOnClose},
+  m_isGood{false}
+{
+  m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  m_isGood = (m_fd >= 0);
+}
+
+OutputSink::~OutputSink()
+{
+  close();
+}
+
+bool OutputSink::isGood() const noexcept
+{
+  return m_isGood;
+}
+
+// Total number of bytes written, including the ones still buffered.
+uint64_t OutputSink::size() const noexcept
+{
+  return m_size;
+}
+
+void OutputSink::write(std::string_view data) noexcept
+{
+  m_size += data.size();
+  if (m_bufferUsed + data.size() > m_buffer.size()) {
+    flushBuffer();
+  }
+  if (data.size() >= m_buffer.size()) {
+    // Too large to be buffered, bypass the buffer.
+    writeToFile(data.data(), data.size());
+    return;
+  }
+  std::memcpy(m_buffer.data() + m_bufferUsed, data.data(), data.size());
+  m_bufferUsed += data.size();
+}
+
+// Writes all remaining data and closes the file. Returns false if any
+// write failed.
+bool OutputSink::close() noexcept
+{
+  if (m_fd >= 0) {
+    flushBuffer();
+    if (m_fsyncOnClose && ::fsync(m_fd) != 0) {
+      m_isGood = false;
+    }
+    if (::close(m_fd) != 0) {
+      m_isGood = false;
+    }
+    m_fd = -1;
+  }
+  return m_isGood;
+}
+
+void OutputSink::writeToFile(char const *data, size_t size) noexcept
+{
+  while (m_isGood && size > 0) {
+    ssize_t const written{::write(m_fd, data, size)};
+    if (written < 0) {
+      if (errno != EINTR) {
+        m_isGood = false;
+      }
+      continue;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+void OutputSink::flushBuffer() noexcept
+{
+  writeToFile(m_buffer.data(), m_bufferUsed);
+  m_bufferUsed = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUT_SINK_HPP
+#define OUTPUT_SINK_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Buffered writer for output files. Data is only handed to the kernel when
+// the buffer is full and on close, optionally followed by an fsync.
+class OutputSink {
+ public:
+  OutputSink(std::string const &, size_t, bool);
+  ~OutputSink();
+
+ private:
+  OutputSink(OutputSink const &) = delete;
+  OutputSink(OutputSink &&) = delete;
+  OutputSink &operator=(OutputSink const &) = delete;
+  OutputSink &operator=(OutputSink &&) = delete;
+
+ public:
+  bool isGood() const noexcept;
+  uint64_t size() const noexcept;
+  void write(std::string_view) noexcept;
+  bool close() noexcept;
+
+ private:
+  void writeToFile(char const *, size_t) noexcept;
+  void flushBuffer() noexcept;
+
+ private:
+  int m_fd;
+  std::vector<char> m_buffer;
+  size_t m_bufferUsed;
+  uint64_t m_size;
+  bool const m_fsyncOnClose;
+  bool m_isGood;
+};
+
+#endif
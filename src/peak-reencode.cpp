@@ -19,435 +19,796 @@
 #include "opendlv-standard-message-set.hpp"
 #include "peak-gps.hpp"
 
-#include <cmath>
+#include "analysis-cache.hpp"
+#include "batch-schedule.hpp"
+#include "chunked-rewriter.hpp"
+#include "chunked-scanner.hpp"
+#include "classifier.hpp"
+#include "correction-rules.hpp"
+#include "envelope-sorter.hpp"
+#include "envelope-transformer.hpp"
+#include "file-copy.hpp"
+#include "float-kernels.hpp"
+#include "output-sink.hpp"
+#include "rec-index.hpp"
+#include "rec-file-view.hpp"
+#include "rewrite-pipeline.hpp"
+#include "run-journal.hpp"
+#include "sampled-classifier.hpp"
+#include "stage-stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cstdint>
-#include <cstring>
+#include <cstdio>
+#include <exception>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
-
-bool processRecFile(std::string const &inPath, std::string const &outPath,
-    std::string const &filename, bool const verbose)
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Options controlling how each recording is reencoded.
+struct ReencodeOptions {
+  bool verbose;
+  bool singlePass;
+  uint64_t singlePassLimit;
+  uint64_t reorderWindow;
+  uint64_t sortMemory;
+  std::string tempDirectory;
+  size_t writeBufferSize;
+  bool fsyncOnClose;
+  bool writeIndex;
+  bool linkUnchanged;
+  bool pipeline;
+  uint32_t chunkThreads;
+  uint32_t analysisThreads;
+  uint64_t chunkSize;
+  uint32_t classifySample;
+  uint64_t classifyWindow;
+  CorrectionRules rules;
+};
+
+// The largest number of threads that may be asked for.
+constexpr uint64_t MAX_THREADS{4096};
+
+// Parses a byte size with an optional K, M, or G suffix, e.g. "512M".
+// Throws std::invalid_argument if not such a size.
+uint64_t parseSize(std::string const &str)
 {
-  {
-    std::filesystem::path out = outPath + "/" + filename;
-    if (std::filesystem::exists(out)) {
-      if (verbose) {
-        std::cout << filename << std::endl;
-        std::cout << " .. exists in destination, skipping." << std::endl;
-      }
-      return true;
+  size_t suffixPos{0};
+  uint64_t size{0};
+  if (!str.empty() && std::isdigit(static_cast<unsigned char>(str[0]))) {
+    try {
+      size = std::stoull(str, &suffixPos);
+    } catch (std::out_of_range const &) {
+      suffixPos = 0;
     }
   }
-  
-  std::fstream fin(inPath + "/" + filename, std::ios::in|std::ios::binary);
-  if (!fin.good()) {
-    std::cerr << "Failed to open in file." << std::endl;
-    return false;
+  if (suffixPos == 0) {
+    throw std::invalid_argument("Invalid size '" + str + "'");
   }
 
-  bool isBeforeSiPatch = false;
-  bool isFromBrokenPatch = false;
-  bool removeSwitchStateReadings = false;
-  bool isFine = true;
-  {
-    double lengthSum{0.0};
-
-    double xPrev{0.0};
-    double yPrev{0.0};
-    double zPrev{0.0};
-    
-    double xChangeMax{0.0};
-    double yChangeMax{0.0};
-    double zChangeMax{0.0};
-    
-    uint64_t sampleCount{0};
-    while (fin.good()) {
-      auto retVal{cluon::extractEnvelope(fin)};
-      if (retVal.first) {
-        cluon::data::Envelope e = retVal.second;
-
-        if (e.dataType() == opendlv::proxy::AccelerationReading::ID()) {
-          opendlv::proxy::AccelerationReading msg = 
-            cluon::extractMessage<opendlv::proxy::AccelerationReading>(
-                std::move(e));
-
-          removeSwitchStateReadings = true;
-
-          double x = msg.accelerationX();
-          double y = msg.accelerationY();
-          double z = msg.accelerationZ();
-
-          lengthSum += std::sqrt(x * x + y * y + z * z);
-
-          if (sampleCount != 0) {
-            double xChange = std::abs(x - xPrev);
-            if (xChange > xChangeMax) {
-              xChangeMax = xChange;
-            }
-            double yChange = std::abs(y - yPrev);
-            if (yChange > yChangeMax) {
-              yChangeMax = yChange;
-            }
-            double zChange = std::abs(z - zPrev);
-            if (zChange > zChangeMax) {
-              zChangeMax = zChange;
-            }
-          }
-    
-          xPrev = x;
-          yPrev = y;
-          zPrev = z;
-          
-          sampleCount++;
-        }
-      }
+  uint64_t unit{1};
+  if (suffixPos < str.size()) {
+    switch (str[suffixPos]) {
+      case 'G':
+      case 'g':
+        unit = 1024 * 1024 * 1024;
+        break;
+      case 'M':
+      case 'm':
+        unit = 1024 * 1024;
+        break;
+      case 'K':
+      case 'k':
+        unit = 1024;
+        break;
+      default:
+        suffixPos = str.size();
+        break;
     }
-    double lengthMean = lengthSum / sampleCount;
-
-    isFromBrokenPatch = (xChangeMax > 2500.0 || yChangeMax > 2500.0 
-        || zChangeMax > 2500.0);
-    if (!isFromBrokenPatch) {
-      isBeforeSiPatch = (lengthMean > 1000.0 && lengthMean < 1060);
+    if (suffixPos + 1 != str.size()) {
+      throw std::invalid_argument("Unknown size suffix in '" + str + "'");
     }
-    isFine = (!isBeforeSiPatch && !isFromBrokenPatch 
-        && !removeSwitchStateReadings);
+  }
+  if (size > std::numeric_limits<uint64_t>::max() / unit) {
+    throw std::invalid_argument("Too large size '" + str + "'");
+  }
+  return size * unit;
+}
 
-    if (verbose) {
-      std::cout << filename << std::endl;
-      if (isBeforeSiPatch) {
-        std::cout << " .. is not in SI units, re-scaling." << std::endl;
-      }
-      if (isFromBrokenPatch) {
-        std::cout << " .. the broken patch was used, fixing." << std::endl;
-      }
-      if (isFine) {
-        std::cout << " .. no errors detected, copy only." << std::endl;
-      } 
-      if (removeSwitchStateReadings) {
-        std::cout << " .. will remove switch state readings." << std::endl;
-      }
-    }
+// The size given for an option, or its default.
+uint64_t sizeOption(std::map<std::string, std::string> const &arguments, 
+    std::string const &name, std::string const &defaultSize)
+{
+  auto const it{arguments.find(name)};
+  try {
+    return parseSize(it != arguments.end() ? it->second : defaultSize);
+  } catch (std::invalid_argument const &e) {
+    throw std::invalid_argument("--" + name + ": " + e.what());
   }
+}
 
-  if (isFine) {
-    std::filesystem::path in = inPath + "/" + filename;
-    std::filesystem::path out = outPath + "/" + filename;
-    std::filesystem::copy_file(in, out);
-    fin.close();
-    return true;
+// Parses a count, e.g., of threads, that is at most the given maximum.
+// Throws std::invalid_argument if not such a count.
+uint64_t parseCount(std::string const &str, uint64_t maxCount)
+{
+  size_t endPos{0};
+  uint64_t count{0};
+  if (!str.empty() && std::isdigit(static_cast<unsigned char>(str[0]))) {
+    try {
+      count = std::stoull(str, &endPos);
+    } catch (std::out_of_range const &) {
+      endPos = 0;
+    }
   }
+  if (endPos == 0 || endPos != str.size()) {
+    throw std::invalid_argument("Invalid number '" + str + "'");
+  }
+  if (count > maxCount) {
+    throw std::invalid_argument("Too large number '" + str + "'");
+  }
+  return count;
+}
 
-  fin.clear();
-  fin.seekg(0, std::ios::beg);
+// The count given for an option, or its default.
+uint64_t countOption(std::map<std::string, std::string> const &arguments, 
+    std::string const &name, uint64_t defaultCount, uint64_t maxCount)
+{
+  auto const it{arguments.find(name)};
+  if (it == arguments.end()) {
+    return defaultCount;
+  }
+  try {
+    return parseCount(it->second, maxCount);
+  } catch (std::invalid_argument const &e) {
+    throw std::invalid_argument("--" + name + ": " + e.what());
+  }
+}
 
-  std::fstream fout(outPath + "/" + filename, std::ios::out|std::ios::binary);
-  if (!fout.good()) {
-    std::cerr << "Failed to open out file." << std::endl;
+// Moves a completely written output file into place. The rename replaces
+// any file at the final path at once, so that a file found there is never
+// partly written, even if the run is killed. With fsync, the folder is
+// synced as well, so that the rename itself survives a crash.
+bool commitOutput(std::string const &partFilename, 
+    std::string const &filename, bool fsyncOnClose) noexcept
+{
+  if (std::rename(partFilename.c_str(), filename.c_str()) != 0) {
     return false;
   }
-  if (!fin.good()) {
-    std::cerr << "Failed to open in file." << std::endl;
+  if (fsyncOnClose) {
+    std::string const folder{filename.substr(0, filename.rfind('/') + 1)};
+    int const fd{::open(folder.c_str(), O_RDONLY | O_DIRECTORY)};
+    if (fd < 0) {
+      return false;
+    }
+    bool const ok{::fsync(fd) == 0};
+    ::close(fd);
+    return ok;
+  }
+  return true;
+}
+
+// All output is written to the given log and error streams rather than
+// directly to std::cout and std::cerr, so that files processed concurrently
+// can have their messages buffered and emitted without interleaving.
+//
+// Output files are written next to their final path, with a .part suffix,
+// and renamed once complete. The index is moved into place first, so that
+// an existing .rec output always had its index written, if asked for.
+//
+// If given stats, the time spent in each stage is added to them.
+//
+// If the file was rewritten from a classification of sampled windows that
+// then did not hold, its output is discarded and isSampleRejected is set.
+bool reencodeRecFile(std::string const &inPath, std::string const &outPath,
+    std::string const &filename, ReencodeOptions const &options, 
+    AnalysisCache *cache, RunJournal *journal, FileStats *stats, 
+    std::ostream &log, std::ostream &err, bool &isSampleRejected)
+{
+  bool const verbose{options.verbose};
+  std::string const inFilename{inPath + "/" + filename};
+  std::string const outFilename{outPath + "/" + filename};
+  std::string const partFilename{outFilename + ".part"};
+  std::string const indexFilename{outFilename + ".idx"};
+  std::string const indexPartFilename{indexFilename + ".part"};
+
+  if (std::filesystem::exists(outFilename)) {
+    if (verbose) {
+      log << filename << std::endl;
+      log << " .. exists in destination, skipping." << std::endl;
+    }
+    if (stats != nullptr) {
+      stats->setSkipped();
+    }
+    return true;
+  }
+  
+  RecFileView view(inFilename);
+  if (!view.isValid()) {
+    err << filename << ": Failed to open in file." << std::endl;
     return false;
   }
-  fin.close();
-
-  // Conversion constants.
-  float const mG_to_mps2{9.80665f/1000.f};
-  float const mT_to_T{1e-6f};
-
-  // We need the Envelopes in strictly ascending temporal order, so
-  // we use cluon::Player to sort the Envelopes by sampleTimePoint.
-  const bool AUTOREWIND{false};
-  const bool THREADING{false};
-  cluon::Player player(inPath + "/" + filename, AUTOREWIND, THREADING);
-
-  // temp buffer to remove duplicated values
-  bool foundAngularVelocityReading{false};
-  double prevAngularVelocityX{0};
-  double prevAngularVelocityY{0};
-  double prevAngularVelocityZ{0};
-  uint32_t skippedAngularVelocityReadingsCounter{0};
-
-  bool foundMagneticFieldReading{false};
-  double prevMagneticFieldX{0};
-  double prevMagneticFieldY{0};
-  double prevMagneticFieldZ{0};
-  uint32_t skippedMagneticFieldReadingsCounter{0};
-
-  bool foundAltitudeReading{false};
-  double prevAltitude{0};
-  uint32_t skippedAltitudeReadingsCounter{0};
-
-  bool foundGroundSpeedReading{false};
-  double prevGroundSpeed{0};
-  uint32_t skippedGroundSpeedReadingsCounter{0};
-
-  bool foundGeodeticHeadingReading{false};
-  double prevGeodeticHeading{0};
-  uint32_t skippedGeodeticHeadingReadingsCounter{0};
-
-  while (player.hasMoreData()) {
-    auto retVal{player.getNextEnvelopeToBeReplayed()};
-    if (retVal.first) {
-      cluon::data::Envelope e = retVal.second;
-      
-      if (e.dataType() == opendlv::proxy::SwitchStateReading::ID() 
-          && removeSwitchStateReadings) {
-        continue;
+
+  // Also removes what an interrupted run left behind.
+  auto discardOutput{[&partFilename, &indexPartFilename]() {
+      std::error_code ec;
+      std::filesystem::remove(partFilename, ec);
+      std::filesystem::remove(indexPartFilename, ec);
+    }};
+  auto finishOutput{[&]() {
+      StageTimer timer(stats, Stage::Write);
+      if ((options.writeIndex && !commitOutput(indexPartFilename, 
+              indexFilename, options.fsyncOnClose))
+          || !commitOutput(partFilename, outFilename, options.fsyncOnClose)) {
+        err << filename << ": Failed to move out file into place." 
+          << std::endl;
+        discardOutput();
+        return false;
+      }
+      if (journal != nullptr) {
+        RecFileView outView(outFilename);
+        if (!outView.isValid()) {
+          err << filename << ": Failed to open out file." << std::endl;
+          return false;
+        }
+        journal->record(filename, JournalEntry{view.size(), 
+            sampledContentHash(view), outView.size(), 
+            sampledContentHash(outView)});
       }
-      else if (e.dataType() == opendlv::device::gps::peak::Acceleration::ID()) {
-        opendlv::device::gps::peak::Acceleration _old 
-          = cluon::extractMessage<opendlv::device::gps::peak::Acceleration>(
-              std::move(e));
+      return true;
+    }};
+  discardOutput();
+
+  // In single-pass mode, the file is read once and both the analysis and
+  // the rewrite work on the mapped bytes. Otherwise, the file is read once
+  // for the analysis and then again to sort it.
+  bool const isSinglePass{options.singlePass 
+    && view.size() <= options.singlePassLimit};
+  if (isSinglePass) {
+    view.willNeed();
+  }
 
-        opendlv::device::gps::peak::Acceleration _new{_old};
+  StageTimer analysisTimer(stats, Stage::Analysis);
 
-        if (isBeforeSiPatch) {
-          _new.accelerationX(_old.accelerationX()*mG_to_mps2)
-            .accelerationY(_old.accelerationY()*mG_to_mps2)
-            .accelerationZ(_old.accelerationZ()*mG_to_mps2);
-        }
+  // A cached analysis of the same file contents replaces the analysis scan.
+  RecFileKey cacheKey{};
+  RecAnalysis analysis{};
+  bool isCached{false};
+  if (cache != nullptr) {
+    cacheKey = recFileKey(inFilename, view);
+    isCached = cache->find(cacheKey, analysis);
+  }
 
-        if (isFromBrokenPatch) {
-          float x = _old.accelerationX();
-          float y = _old.accelerationY();
-          float z = _old.accelerationZ();
-          if (x > 1250.0f) {
-            x -= 2512.874f;
-          }
-          if (y > 1250.0f) {
-            y -= 2512.874f;
-          }
-          if (z > 1250.0f) {
-            z -= 2512.874f;
-          }
-          _new.accelerationX(x)
-            .accelerationY(y)
-            .accelerationZ(z);
+  // An index written by an earlier run lists the Envelopes in time order,
+  // so that the file does not need to be scanned to find its order.
+  std::vector<IndexEntry> index;
+  bool const mayUseIndex{!isCached || (analysis.classification.isFine 
+      ? options.writeIndex : analysis.outOfOrderCount > 0)};
+  bool const hasSidecarIndex{mayUseIndex 
+    && readRecIndex(inFilename, view.size(), index)};
+  bool hasIndex{hasSidecarIndex};
+
+  // Where each chunk starts, if the file is to be rewritten in chunks. Not
+  // known for a cached analysis, which is then rewritten sequentially.
+  std::vector<uint64_t> chunkOffsets;
+
+  // A classification settled from sampled windows, not to be cached.
+  bool isSampled{false};
+  double sampleConfidence{0.0};
+  uint32_t sampledWindows{0};
+  uint64_t sampledReadings{0};
+  char const *unsettledReason{nullptr};
+
+  bool isOrdered{true};
+  if (isCached) {
+    isOrdered = (analysis.outOfOrderCount == 0);
+  } else if (hasSidecarIndex) {
+    // Only the AccelerationReadings are needed, in file order.
+    std::vector<uint64_t> offsets;
+    for (size_t i{0}; i < index.size(); i++) {
+      if (i > 0 && index[i].offset < index[i - 1].offset) {
+        isOrdered = false;
+      }
+      if (index[i].dataType == opendlv::proxy::AccelerationReading::ID()) {
+        offsets.push_back(index[i].offset);
+      }
+    }
+    std::sort(offsets.begin(), offsets.end());
+    Classifier classifier;
+    EnvelopeSpan span;
+    for (uint64_t const offset : offsets) {
+      if (view.spanAt(offset, span)) {
+        classifier.add(span.dataType, view.serializedData(span));
+      }
+    }
+    analysis.statistics = classifier.statistics();
+    analysis.classification = classifier.classification();
+
+    if (isOrdered && options.chunkThreads > 1) {
+      for (auto const &entry : index) {
+        if (chunkOffsets.empty() 
+            || entry.offset >= chunkOffsets.back() + options.chunkSize) {
+          chunkOffsets.push_back(entry.offset);
         }
-
-        cluon::ToProtoVisitor proto;
-        _new.accept(proto);
-        e.serializedData(proto.encodedData());
       }
-      else if (e.dataType() == opendlv::proxy::AccelerationReading::ID()) {
-        opendlv::proxy::AccelerationReading _old = 
-          cluon::extractMessage<opendlv::proxy::AccelerationReading>(
-              std::move(e));
-        
-        opendlv::proxy::AccelerationReading _new{_old};
-
-        if (isBeforeSiPatch) {
-          _new.accelerationX(_old.accelerationX()*mG_to_mps2)
-            .accelerationY(_old.accelerationY()*mG_to_mps2)
-            .accelerationZ(_old.accelerationZ()*mG_to_mps2);
+    }
+  } else {
+    bool const collectIndex{isSinglePass || options.writeIndex};
+    bool const collectChunks{options.chunkThreads > 1};
+    Classifier classifier;
+    OrderTracker orderTracker(options.reorderWindow);
+
+    // A settled sample replaces the scan. The file is then taken to be in
+    // order, and both are checked while it is rewritten.
+    if (options.classifySample > 0) {
+      SampledClassifier sampler(view, options.classifySample, 
+          options.classifyWindow);
+      isSampled = sampler.classify();
+      sampleConfidence = sampler.confidence();
+      sampledWindows = sampler.windowsRead();
+      sampledReadings = sampler.classifier().statistics().sampleCount;
+      if (isSampled) {
+        classifier = sampler.classifier();
+      } else {
+        unsettledReason = sampler.unsettledReason();
+      }
+    }
+
+    // The chunked scan finds if the file is in order, but not how far 
+    // Envelopes are out of order, which then needs a sequential scan of the
+    // time stamps.
+    bool isScanned{false};
+    if (!isSampled && options.analysisThreads > 1 
+        && view.size() > options.chunkSize) {
+      ChunkedScanner scanner(view, options.analysisThreads, 
+          options.chunkSize, collectIndex);
+      scanner.scan();
+      if (!scanner.classifier().isNearThreshold()) {
+        isScanned = true;
+        classifier = scanner.classifier();
+        index = std::move(scanner.index());
+        if (collectChunks) {
+          chunkOffsets = scanner.chunkOffsets();
         }
-        
-        if (isFromBrokenPatch) {
-          float x = _old.accelerationX();
-          float y = _old.accelerationY();
-          float z = _old.accelerationZ();
-          if (x > 1250.0f) {
-            x -= 2512.874f;
+        if (!scanner.isOrdered()) {
+          EnvelopeSpan span;
+          uint64_t pos{0};
+          while (view.next(pos, span)) {
+            orderTracker.add(span.sampleTimeStamp);
           }
-          if (y > 1250.0f) {
-            y -= 2512.874f;
-          }
-          if (z > 1250.0f) {
-            z -= 2512.874f;
-          }
-          _new.accelerationX(x)
-            .accelerationY(y)
-            .accelerationZ(z);
         }
-
-        cluon::ToProtoVisitor proto;
-        _new.accept(proto);
-        e.serializedData(proto.encodedData());
       }
-      else if (e.dataType() == opendlv::proxy::MagneticFieldReading::ID()) {
-        opendlv::proxy::MagneticFieldReading _old 
-          = cluon::extractMessage<opendlv::proxy::MagneticFieldReading>(
-              std::move(e));
-
-        // Do we need to skip this due to a duplicated value?
-        {
-          double x = _old.magneticFieldX();
-          double y = _old.magneticFieldY();
-          double z = _old.magneticFieldZ();
-          if (foundMagneticFieldReading) {
-            if (::memcmp(&x, &prevMagneticFieldX, 8) == 0
-                || ::memcmp(&y, &prevMagneticFieldY, 8) == 0
-                || ::memcmp(&z, &prevMagneticFieldZ, 8) == 0) {
-              skippedMagneticFieldReadingsCounter++;
-              continue;
-            }
-          }
-          foundMagneticFieldReading = true;
-          prevMagneticFieldX = x;
-          prevMagneticFieldY = y;
-          prevMagneticFieldZ = z;
-        }
-        
-        opendlv::proxy::MagneticFieldReading _new{_old};
+    }
 
-        if (isBeforeSiPatch) {
-          _new.magneticFieldX(_old.magneticFieldX()*mT_to_T)
-            .magneticFieldY(_old.magneticFieldY()*mT_to_T)
-            .magneticFieldZ(_old.magneticFieldZ()*mT_to_T);
+    if (!isScanned && !isSampled) {
+      index.clear();
+      chunkOffsets.clear();
+      EnvelopeSpan span;
+      uint64_t pos{0};
+      while (view.next(pos, span)) {
+        if (collectIndex) {
+          index.push_back(IndexEntry{span.sampleTimeStamp, span.offset, 
+              span.length, span.dataType, span.senderStamp});
         }
-        
-        if (isFromBrokenPatch) {
-          float x = _old.magneticFieldX();
-          float y = _old.magneticFieldY();
-          float z = _old.magneticFieldZ();
-          if (x > 0.01f) {
-            x -= 0.0196605f;
-          }
-          if (y > 0.01f) {
-            y -= 0.0196605f;
-          }
-          if (z > 0.01f) {
-            z -= 0.0196605f;
-          }
-          _new.magneticFieldX(x)
-            .magneticFieldY(y)
-            .magneticFieldZ(z);
+        if (collectChunks && (chunkOffsets.empty() 
+              || span.offset >= chunkOffsets.back() + options.chunkSize)) {
+          chunkOffsets.push_back(span.offset);
         }
-
-        cluon::ToProtoVisitor proto;
-        _new.accept(proto);
-        e.serializedData(proto.encodedData());
+        orderTracker.add(span.sampleTimeStamp);
+        classifier.add(span.dataType, view.serializedData(span));
       }
-      else if (e.dataType() == opendlv::proxy::AngularVelocityReading::ID()) {
-        opendlv::proxy::AngularVelocityReading _old 
-          = cluon::extractMessage<opendlv::proxy::AngularVelocityReading>(
-              std::move(e));
-
-        // Do we need to skip this due to a duplicated value?
-        {
-          double x = _old.angularVelocityX();
-          double y = _old.angularVelocityY();
-          double z = _old.angularVelocityZ();
-          if (foundAngularVelocityReading) {
-            if (::memcmp(&x, &prevAngularVelocityX, 8) == 0
-                || ::memcmp(&y, &prevAngularVelocityY, 8) == 0
-                || ::memcmp(&z, &prevAngularVelocityZ, 8) == 0) {
-              skippedAngularVelocityReadingsCounter++;
-              continue;
-            }
-          }
-          foundAngularVelocityReading = true;
-          prevAngularVelocityX = x;
-          prevAngularVelocityY = y;
-          prevAngularVelocityZ = z;
-        }
-        
-        opendlv::proxy::AngularVelocityReading _new{_old};
+    }
+    isOrdered = orderTracker.isOrdered();
+    hasIndex = collectIndex && !isSampled;
+
+    // Same order as cluon::Player, i.e., ascending sampleTimeStamp and 
+    // file order for equal time stamps.
+    if (collectIndex && !isOrdered) {
+      std::stable_sort(index.begin(), index.end(), 
+          [](IndexEntry const &a, IndexEntry const &b) { 
+            return a.sampleTimeStamp < b.sampleTimeStamp; 
+          });
+    }
 
-        cluon::ToProtoVisitor proto;
-        _new.accept(proto);
-        e.serializedData(proto.encodedData());
-      }
-      if (e.dataType() == opendlv::proxy::AltitudeReading::ID()) {
-        auto msg = cluon::extractMessage<opendlv::proxy::AltitudeReading>(std::move(e));
-        double x = msg.altitude();
-        if (foundAltitudeReading) {
-          if (prevAltitude - x >  0.98 * std::abs(prevAltitude)) {
-            skippedAltitudeReadingsCounter++;
-            continue;
-          }
-          if (::memcmp(&x, &prevAltitude, 8) == 0) {
-            skippedAltitudeReadingsCounter++;
-            continue;
-          }
-        }
-        foundAltitudeReading = true;
-        prevAltitude = x;
+    analysis = RecAnalysis{classifier.statistics(), 
+      classifier.classification(), orderTracker.outOfOrderCount(), 
+      orderTracker.window(), orderTracker.fitsWindow()};
+    if (cache != nullptr && !isSampled) {
+      cache->store(cacheKey, analysis);
+    }
+  }
+  analysisTimer.stop();
+  Classification const classification{analysis.classification};
+  bool const knowsOrder{isCached || !hasSidecarIndex};
 
-        cluon::ToProtoVisitor proto;
-        msg.accept(proto);
-        e.serializedData(proto.encodedData());
+  if (verbose) {
+    log << filename << std::endl;
+    if (isCached) {
+      log << " .. using the cached analysis." << std::endl;
+    }
+    if (hasSidecarIndex) {
+      log << " .. using the index in " << filename << ".idx." << std::endl;
+    }
+    if (isSampled) {
+      log << " .. classified from " << sampledReadings << " readings in " 
+        << sampledWindows << " sampled windows, confidence " 
+        << sampleConfidence << "." << std::endl;
+    } else if (unsettledReason != nullptr) {
+      log << " .. sampling did not settle, " << unsettledReason;
+      if (sampledWindows > 0) {
+        log << " (confidence " << sampleConfidence << " from " 
+          << sampledReadings << " readings in " << sampledWindows 
+          << " windows)";
       }
-      if (e.dataType() == opendlv::proxy::GroundSpeedReading::ID()) {
-        auto msg = cluon::extractMessage<opendlv::proxy::GroundSpeedReading>(std::move(e));
-        double x = msg.groundSpeed();
-        if (foundGroundSpeedReading) {
-          if (prevGroundSpeed - x >  0.98 * std::abs(prevGroundSpeed)) {
-            skippedGroundSpeedReadingsCounter++;
-            continue;
-          }
-          if (::memcmp(&x, &prevGroundSpeed, 8) == 0) {
-            skippedGroundSpeedReadingsCounter++;
-            continue;
-          }
-        }
-        foundGroundSpeedReading = true;
-        prevGroundSpeed = x;
+      log << ", scanned in full." << std::endl;
+    }
+    if (classification.isBeforeSiPatch) {
+      log << " .. is not in SI units, re-scaling." << std::endl;
+    }
+    if (classification.isFromBrokenPatch) {
+      log << " .. the broken patch was used, fixing." << std::endl;
+    }
+    if (classification.isFine) {
+      log << " .. no errors detected, copy only." << std::endl;
+    } 
+    if (classification.removeSwitchStateReadings) {
+      log << " .. will remove switch state readings." << std::endl;
+    }
+    if (!classification.isFine && knowsOrder && !isOrdered) {
+      log << " .. " << analysis.outOfOrderCount 
+        << " Envelopes out of order." << std::endl;
+    }
+  }
 
-        cluon::ToProtoVisitor proto;
-        msg.accept(proto);
-        e.serializedData(proto.encodedData());
-      }
-      if (e.dataType() == opendlv::proxy::GeodeticHeadingReading::ID()) {
-        auto msg = cluon::extractMessage<opendlv::proxy::GeodeticHeadingReading>(std::move(e));
-        double x = msg.northHeading();
-        if (std::abs(x) < 0.001) {
-          continue;
-        }
-        if (foundGeodeticHeadingReading) {
-          if (prevGeodeticHeading - x >  0.98 * std::abs(prevGeodeticHeading)) {
-            skippedGeodeticHeadingReadingsCounter++;
-            continue;
-          }
-          if (::memcmp(&x, &prevGeodeticHeading, 8) == 0) {
-            skippedGeodeticHeadingReadingsCounter++;
-            continue;
-          }
+  if (classification.isFine) {
+    CopyMethod method;
+    StageTimer copyTimer(stats, Stage::Copy);
+    if (!copyUnchangedFile(inFilename, partFilename, options.linkUnchanged, 
+          options.fsyncOnClose, method)) {
+      err << filename << ": Failed to copy to out file." << std::endl;
+      return false;
+    }
+    copyTimer.stop();
+    if (verbose) {
+      log << " .. copied using " << copyMethodName(method) << "." 
+        << std::endl;
+    }
+    if (options.writeIndex) {
+      StageTimer indexTimer(stats, Stage::Index);
+      if (!hasIndex) {
+        EnvelopeSpan span;
+        uint64_t pos{0};
+        while (view.next(pos, span)) {
+          index.push_back(IndexEntry{span.sampleTimeStamp, span.offset, 
+              span.length, span.dataType, span.senderStamp});
         }
-        foundGeodeticHeadingReading = true;
-        prevGeodeticHeading = x;
+        std::stable_sort(index.begin(), index.end(), 
+            [](IndexEntry const &a, IndexEntry const &b) { 
+              return a.sampleTimeStamp < b.sampleTimeStamp; 
+            });
+      }
+      RecIndexWriter indexWriter(indexPartFilename);
+      if (!indexWriter.isGood()) {
+        err << filename << ": Failed to open index file " 
+          << std::filesystem::path(indexPartFilename).lexically_normal() 
+          .string() << "." << std::endl;
+        discardOutput();
+        return false;
+      }
+      for (auto const &entry : index) {
+        indexWriter.add(entry);
+      }
+      if (!indexWriter.close(view.size())) {
+        err << filename << ": Failed to write index file." << std::endl;
+        discardOutput();
+        return false;
+      }
+    }
+    if (stats != nullptr) {
+      stats->setCopied(view.size());
+    }
+    return finishOutput();
+  }
+
+  OutputSink sink(partFilename, options.writeBufferSize, 
+      options.fsyncOnClose);
+  if (!sink.isGood()) {
+    err << filename << ": Failed to open out file." << std::endl;
+    return false;
+  }
 
-        cluon::ToProtoVisitor proto;
-        msg.accept(proto);
-        e.serializedData(proto.encodedData());
+  StageTimer rewriteTimer(stats, Stage::Rewrite);
+  EnvelopeTransformer transformer(classification, options.rules);
+  transformer.setStats(stats);
+  std::unique_ptr<RecIndexWriter> indexWriter;
+  EnvelopeTransformer::Indexer indexer;
+  if (options.writeIndex) {
+    indexWriter = std::make_unique<RecIndexWriter>(indexPartFilename);
+    if (!indexWriter->isGood()) {
+      err << filename << ": Failed to open index file " 
+        << std::filesystem::path(indexPartFilename).lexically_normal() 
+        .string() << "." << std::endl;
+      sink.close();
+      discardOutput();
+      return false;
+    }
+    indexer = [&indexWriter](IndexEntry const &entry) { 
+      indexWriter->add(entry); 
+    };
+    transformer.setIndexer(indexer);
+  }
+  bool const isChunked{isOrdered && chunkOffsets.size() > 1};
+
+  // Declared before the pipeline, since sorted frames may refer to its 
+  // memory until the pipeline is finished.
+  EnvelopeSorter sorter(options.sortMemory, options.tempDirectory);
+
+  std::unique_ptr<RewritePipeline> pipeline;
+  if (options.pipeline && !isChunked) {
+    pipeline = std::make_unique<RewritePipeline>(transformer, sink);
+  }
+  auto writeBatch{[&transformer, &sink](EnvelopeTransformer::Batch &batch) {
+      transformer.writeBatch(batch, sink);
+    }};
+  auto transformAndWrite{[&transformer, &pipeline, &writeBatch](
+        std::string_view frame, EnvelopeSpan const &span) {
+      if (pipeline) {
+        pipeline->push(frame, span);
+      } else {
+        transformer.push(frame, span, writeBatch);
       }
+    }};
 
-      std::string serializedData{cluon::serializeEnvelope(std::move(e))};
-      fout.write(serializedData.data(), serializedData.size());
-      fout.flush();
+  if (isChunked) {
+    ChunkedRewriter rewriter(view, classification, options.rules, 
+        options.chunkThreads);
+    rewriter.rewrite(chunkOffsets, transformer, indexer, sink);
+    if (verbose) {
+      log << " .. rewritten in " << chunkOffsets.size() << " chunks, " 
+        << rewriter.redoneChunkCount() << " redone at the seams." 
+        << std::endl;
+    }
+  } else if (isSampled) {
+    // Streamed as if in order, until found not to be, or not to be of the
+    // sampled classification. The file is then analysed in full and 
+    // rewritten again.
+    SampleVerifier verifier(classification);
+    bool isVerified{true};
+    EnvelopeSpan span;
+    uint64_t pos{0};
+    while (isVerified && view.next(pos, span)) {
+      isVerified = verifier.add(span, view.serializedData(span));
+      if (isVerified) {
+        transformAndWrite(view.frame(span), span);
+      }
+    }
+    if (!isVerified || !verifier.holds()) {
+      // Closed before discarding, so that nothing is flushed into the
+      // removed files.
+      if (pipeline) {
+        pipeline->finish();
+      }
+      sink.close();
+      indexWriter.reset();
+      rewriteTimer.stop();
+      discardOutput();
+      if (verbose) {
+        log << " .. the sampled classification did not hold, analysing "
+          << "in full." << std::endl;
+      }
+      isSampleRejected = true;
+      return false;
+    }
+    if (cache != nullptr) {
+      Classifier const &classifier{verifier.classifier()};
+      cache->store(cacheKey, RecAnalysis{classifier.statistics(), 
+          classifier.classification(), 0, 0, true});
     }
+  } else if (isOrdered) {
+    // Already in order, stream the file as it is.
+    EnvelopeSpan span;
+    uint64_t pos{0};
+    while (view.next(pos, span)) {
+      transformAndWrite(view.frame(span), span);
+    }
+  } else if (knowsOrder && analysis.isWindowBounded 
+      && analysis.window <= options.reorderWindow) {
+    reorderInWindow(view, analysis.window, transformAndWrite);
+  } else if (hasIndex) {
+    EnvelopeSpan span;
+    for (auto const &entry : index) {
+      if (view.spanAt(entry.offset, span)) {
+        transformAndWrite(view.frame(span), span);
+      }
+    }
+  } else {
+    // We need the Envelopes in strictly ascending temporal order. Runs of
+    // sorted Envelopes that do not fit in memory are spilled to disk.
+    if (!sorter.sort(view, transformAndWrite)) {
+      err << filename << ": Failed to write temporary files to " 
+        << options.tempDirectory << "." << std::endl;
+      discardOutput();
+      return false;
+    }
+    if (verbose && sorter.runCount() > 0) {
+      log << " .. sorted in " << sorter.runCount() << " runs on disk." 
+        << std::endl;
+    }
+  }
+  if (pipeline) {
+    pipeline->finish();
+  } else {
+    transformer.flush(writeBatch);
   }
+  rewriteTimer.stop();
   if (verbose) {
-    std::cout << "..skipped " << skippedMagneticFieldReadingsCounter << " duplicated MagneticFieldReadings" << std::endl;
-    std::cout << "..skipped " << skippedAngularVelocityReadingsCounter << " duplicated AngularVelocityReadings" << std::endl;
-    std::cout << "..skipped " << skippedAltitudeReadingsCounter << " duplicated or invalid AltitudeReadings" << std::endl;
-    std::cout << "..skipped " << skippedGroundSpeedReadingsCounter << " duplicated or invalid GroundSpeedReadings" << std::endl;
-    std::cout << "..skipped " << skippedGeodeticHeadingReadingsCounter << " duplicated or invalid GeodeticHeadingReadings" << std::endl;
+    transformer.printSummary(log);
   }
 
-  fout.close();
-  return true;
+  StageTimer writeTimer(stats, Stage::Write);
+  if (!sink.close()) {
+    err << filename << ": Failed to write out file." << std::endl;
+    discardOutput();
+    return false;
+  }
+  writeTimer.stop();
+  StageTimer indexTimer(stats, Stage::Index);
+  if (indexWriter && !indexWriter->close(sink.size())) {
+    err << filename << ": Failed to write index file." << std::endl;
+    discardOutput();
+    return false;
+  }
+  indexTimer.stop();
+  if (stats != nullptr) {
+    stats->setRewritten(view.size(), sink.size(), 
+        transformer.envelopeCount());
+  }
+  return finishOutput();
+}
+
+// Reencodes a recording as above. A file whose sampled classification did
+// not hold is analysed in full and reencoded again, once the state of the
+// first attempt is released.
+bool processRecFile(std::string const &inPath, std::string const &outPath,
+    std::string const &filename, ReencodeOptions const &options, 
+    AnalysisCache *cache, RunJournal *journal, FileStats *stats, 
+    std::ostream &log, std::ostream &err)
+{
+  bool isSampleRejected{false};
+  bool const ok{reencodeRecFile(inPath, outPath, filename, options, cache, 
+      journal, stats, log, err, isSampleRejected)};
+  if (!isSampleRejected) {
+    return ok;
+  }
+  ReencodeOptions fullOptions{options};
+  fullOptions.classifySample = 0;
+  return reencodeRecFile(inPath, outPath, filename, fullOptions, cache, 
+      journal, stats, log, err, isSampleRejected);
 }
 
+void printUsage(std::string const &program)
+{
+  std::cerr << program << " reencodes an existing recording file to "
+    << "transcode non-SI units to SI-units for PEAK GPS." << std::endl;
+  std::cerr << "Usage:   " << program << " --in=<existing folder with recordings> "
+    << "--out=<output folder> [--verbose]" << std::endl;
+  std::cerr << "  --jobs=<number of files processed concurrently, default: "
+    << "number of cores>" << std::endl;
+  std::cerr << "  --single-pass: read each file only once, if at most "
+    << "--single-pass-limit=<size, default: 4G>" << std::endl;
+  std::cerr << "  --reorder-window=<largest number of Envelopes to hold "
+    << "back when nearly in order, default: 65536>" << std::endl;
+  std::cerr << "  --sort-memory=<memory used to sort each file, default: "
+    << "512M>" << std::endl;
+  std::cerr << "  --pipeline: read, transform, and write each file on "
+    << "separate threads" << std::endl;
+  std::cerr << "  --chunk-threads=<threads rewriting chunks of each "
+    << "file in time order concurrently, default: 1>" << std::endl;
+  std::cerr << "  --analysis-threads=<threads analysing chunks of each "
+    << "file concurrently, default: 1>" << std::endl;
+  std::cerr << "  --chunk-size=<size of such chunks, default: 64M>" 
+    << std::endl;
+  std::cerr << "  --classify-sample=<number of windows to classify each "
+    << "file from, if settled, to rewrite it without a scan, checked as it "
+    << "is rewritten, e.g. 64>" << std::endl;
+  std::cerr << "  --classify-window=<size of such windows, default: 1M>" 
+    << std::endl;
+  std::cerr << "  --rules=<file of correction rules to use instead of the "
+    << "built-in ones>" << std::endl;
+  std::cerr << "  --tmp=<folder for temporary files>" << std::endl;
+  std::cerr << "  --write-buffer=<output buffer size, default: 8M>" 
+    << std::endl;
+  std::cerr << "  --fsync: sync each output file to disk when closed" 
+    << std::endl;
+  std::cerr << "  --index: write a .rec.idx index next to each output file" 
+    << std::endl;
+  std::cerr << "  --link-unchanged: hard link files that need no changes "
+    << "instead of copying them" << std::endl;
+  std::cerr << "  --cache=<file keeping the analysis of each input file "
+    << "between runs>" << std::endl;
+  std::cerr << "  --journal=<file listing the finished files, which are "
+    << "skipped when the run is resumed>" << std::endl;
+  std::cerr << "  --stats=<JSON file of the time spent in each stage, "
+    << "per file and for the run>" << std::endl;
+  std::cerr << "Example: " << program << " --in=in-rec --out=out-rec" 
+    << std::endl;
+}
 
 int32_t main(int32_t argc, char **argv) {
   int32_t retCode{0};
   auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
   if ( (0 == commandlineArguments.count("in")) 
       || (0 == commandlineArguments.count("out")) ) {
-    std::cerr << argv[0] << " reencodes an existing recording file to "
-      << "transcode non-SI units to SI-units for PEAK GPS." << std::endl;
-    std::cerr << "Usage:   " << argv[0] << " --in=<existing folder with recordings> "
-      << "--out=<output folder> [--verbose]" << std::endl;
-    std::cerr << "Example: " << argv[0] << " --in=in-rec --out=out-rec" 
-      << std::endl;
+    printUsage(argv[0]);
     retCode = 1;
   } else {
-    bool const verbose{commandlineArguments.count("verbose") != 0};
+    ReencodeOptions options{};
+    options.verbose = (commandlineArguments.count("verbose") != 0);
+    options.singlePass = (commandlineArguments.count("single-pass") != 0);
+    options.tempDirectory = std::filesystem::temp_directory_path().string();
+    if (commandlineArguments.count("tmp") != 0) {
+      options.tempDirectory = commandlineArguments["tmp"];
+    }
+    options.fsyncOnClose = (commandlineArguments.count("fsync") != 0);
+    options.writeIndex = (commandlineArguments.count("index") != 0);
+    options.pipeline = (commandlineArguments.count("pipeline") != 0);
+    uint32_t jobs{0};
+    try {
+      options.singlePassLimit = sizeOption(commandlineArguments, 
+          "single-pass-limit", "4G");
+      options.reorderWindow = countOption(commandlineArguments, 
+          "reorder-window", 65536, std::numeric_limits<uint64_t>::max());
+      options.sortMemory = sizeOption(commandlineArguments, "sort-memory", 
+          "512M");
+      options.writeBufferSize = sizeOption(commandlineArguments, 
+          "write-buffer", "8M");
+      options.chunkThreads = static_cast<uint32_t>(countOption(
+            commandlineArguments, "chunk-threads", 1, MAX_THREADS));
+      options.analysisThreads = static_cast<uint32_t>(countOption(
+            commandlineArguments, "analysis-threads", 1, MAX_THREADS));
+      options.chunkSize = sizeOption(commandlineArguments, "chunk-size", 
+          "64M");
+      options.classifySample = static_cast<uint32_t>(countOption(
+            commandlineArguments, "classify-sample", 0, 
+            std::numeric_limits<uint32_t>::max()));
+      options.classifyWindow = sizeOption(commandlineArguments, 
+          "classify-window", "1M");
+      jobs = static_cast<uint32_t>(countOption(commandlineArguments, "jobs", 
+            0, MAX_THREADS));
+    } catch (std::invalid_argument const &e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      printUsage(argv[0]);
+      return 1;
+    }
+    options.linkUnchanged = 
+      (commandlineArguments.count("link-unchanged") != 0);
+    options.rules = defaultCorrectionRules();
+    if (commandlineArguments.count("rules") != 0) {
+      try {
+        options.rules = loadCorrectionRules(commandlineArguments["rules"]);
+      } catch (std::invalid_argument const &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return -1;
+      }
+    }
+
+    if (jobs == 0) {
+      jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    }
 
     std::filesystem::path inPath = commandlineArguments["in"] + "/";
     std::filesystem::path outPath = commandlineArguments["out"] + "/";
@@ -461,6 +822,40 @@ int32_t main(int32_t argc, char **argv) {
     std::string inPathAbs = std::filesystem::absolute(inPath).string();
     std::string outPathAbs = std::filesystem::absolute(outPath).string();
 
+    std::unique_ptr<AnalysisCache> cache;
+    if (commandlineArguments.count("cache") != 0) {
+      cache = std::make_unique<AnalysisCache>(commandlineArguments["cache"]);
+      if (!cache->isGood()) {
+        std::cerr << "ERROR: Cannot open the analysis cache " 
+          << commandlineArguments["cache"] << ", or it is not an analysis "
+          << "cache." << std::endl;
+        return -1;
+      }
+    }
+
+    std::unique_ptr<RunJournal> journal;
+    if (commandlineArguments.count("journal") != 0) {
+      journal = std::make_unique<RunJournal>(commandlineArguments["journal"], 
+          std::filesystem::absolute(inPath).lexically_normal().string(), 
+          std::filesystem::absolute(outPath).lexically_normal().string());
+      if (journal->isForOtherFolders()) {
+        std::cerr << "ERROR: The journal " << commandlineArguments["journal"] 
+          << " is of other --in or --out folders." << std::endl;
+        return -1;
+      }
+      if (!journal->isGood()) {
+        std::cerr << "ERROR: Cannot open the journal " 
+          << commandlineArguments["journal"] << ", or it is not a journal." 
+          << std::endl;
+        return -1;
+      }
+    }
+
+    // All files are listed with their sizes before any is processed, so
+    // that the most costly ones can be started first.
+    std::vector<BatchFile> files;
+    uint64_t totalSize{0};
+    size_t doneCount{0};
     for (auto const &entry : 
         std::filesystem::recursive_directory_iterator(inPath)) {
 
@@ -468,15 +863,113 @@ int32_t main(int32_t argc, char **argv) {
         std::string filename = entry.path().string();
         std::string relativeFilename = filename.substr(inPathAbs.length());
 
+        uint64_t const size{entry.file_size()};
+        if (journal && journal->isDone(relativeFilename, size)) {
+          doneCount++;
+          continue;
+        }
+
         std::filesystem::path out = outPath.string() + relativeFilename;
         std::filesystem::create_directories(out.parent_path());
 
-        bool ok = processRecFile(inPathAbs, outPathAbs, relativeFilename, verbose);
-        if (!ok) {
-          return -1;
+        RecAnalysis analysis{};
+        bool const isCached{cache 
+          && cache->findUnread(filename, size, analysis)};
+        files.push_back(BatchFile{relativeFilename, size, 
+            estimateCost(size, isCached ? &analysis : nullptr)});
+        totalSize += size;
+      }
+    }
+    scheduleLargestFirst(files);
+
+    std::unique_ptr<StatsReport> report;
+    if (commandlineArguments.count("stats") != 0) {
+      report = std::make_unique<StatsReport>();
+    }
+
+    // Each worker picks the next unprocessed file, the most costly first.
+    // The output of a file is buffered and written in one go once the file
+    // is done.
+    std::atomic<size_t> nextFile{0};
+    std::mutex outputMutex;
+    std::vector<std::string> failedFilenames;
+    auto worker{[&]() {
+        while (true) {
+          size_t const i{nextFile++};
+          if (i >= files.size()) {
+            break;
+          }
+          std::string const &relativeFilename = files[i].relativeFilename;
+
+          std::ostringstream log;
+          std::ostringstream err;
+          FileStats stats;
+          auto const start{std::chrono::steady_clock::now()};
+          bool ok{false};
+          try {
+            ok = processRecFile(inPathAbs, outPathAbs, relativeFilename, 
+                options, cache.get(), journal.get(), 
+                report ? &stats : nullptr, log, err);
+          } catch (std::exception const &e) {
+            err << relativeFilename << ": " << e.what() << std::endl;
+          }
+          if (report) {
+            report->add(relativeFilename, ok, elapsedNanoseconds(start), 
+                stats);
+          }
+
+          std::lock_guard<std::mutex> lock(outputMutex);
+          std::cout << log.str() << std::flush;
+          std::cerr << err.str() << std::flush;
+          if (!ok) {
+            failedFilenames.push_back(relativeFilename);
+          }
         }
+      }};
+
+    if (options.verbose) {
+      std::cout << "Using " << floatKernelName() << " float corrections, "
+        << jobs << " jobs." << std::endl;
+      if (cache) {
+        std::cout << "Found " << cache->size() << " cached analyses." 
+          << std::endl;
+      }
+      std::cout << "Processing " << files.size() << " files of " 
+        << totalSize << " bytes, the most costly first." << std::endl;
+      if (journal) {
+        std::cout << "Skipping " << doneCount << " files finished in "
+          << "earlier runs." << std::endl;
+      }
+      if (commandlineArguments.count("rules") != 0) {
+        std::cout << "Using " << options.rules.size() << " message rules "
+          << "from " << commandlineArguments["rules"] << "." << std::endl;
+      }
+    }
+
+    auto const runStart{std::chrono::steady_clock::now()};
+    std::vector<std::thread> workers;
+    size_t const workerCount{std::min<size_t>(jobs, files.size())};
+    for (size_t i{0}; i < workerCount; i++) {
+      workers.emplace_back(worker);
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+
+    if (report && !report->write(commandlineArguments["stats"], 
+          elapsedNanoseconds(runStart))) {
+      std::cerr << "ERROR: Cannot write the stats to " 
+        << commandlineArguments["stats"] << std::endl;
+      retCode = -1;
+    }
 
+    if (!failedFilenames.empty()) {
+      std::cerr << "ERROR: Failed to reencode " << failedFilenames.size() 
+        << " of " << files.size() << " files:" << std::endl;
+      for (auto const &failedFilename : failedFilenames) {
+        std::cerr << "  " << failedFilename << std::endl;
       }
+      retCode = -1;
     }
   }
   return retCode;
@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rec-file-view.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t OD4_HEADER_SIZE{5};
+
+bool readVarInt(char const *&p, char const *end, uint64_t &value) noexcept
+{
+  value = 0;
+  for (uint32_t shift{0}; p < end && shift < 64; shift += 7) {
+    uint8_t const b{static_cast<uint8_t>(*p++)};
+    value |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+float readFloat(char const *p) noexcept
+{
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  v = le32toh(v);
+  float f;
+  std::memcpy(&f, &v, sizeof(f));
+  return f;
+}
+
+int32_t fromZigZag32(uint64_t v) noexcept
+{
+  uint32_t const u{static_cast<uint32_t>(v)};
+  return static_cast<int32_t>((u >> 1) ^ -(u & 1));
+}
+
+// Skips a field of the given proto wire type, returns false if malformed.
+bool skipField(char const *&p, char const *end, uint8_t wireType) noexcept
+{
+  uint64_t length{0};
+  switch (wireType) {
+    case 0:
+      return readVarInt(p, end, length);
+    case 1:
+      length = 8;
+      break;
+    case 2:
+      if (!readVarInt(p, end, length)) {
+        return false;
+      }
+      break;
+    case 5:
+      length = 4;
+      break;
+    default:
+      return false;
+  }
+  if (length > static_cast<uint64_t>(end - p)) {
+    return false;
+  }
+  p += length;
+  return true;
+}
+
+int64_t decodeTimeStamp(char const *p, char const *end) noexcept
+{
+  int32_t seconds{0};
+  int32_t microseconds{0};
+  while (p < end) {
+    uint64_t key{0};
+    if (!readVarInt(p, end, key)) {
+      break;
+    }
+    uint8_t const wireType{static_cast<uint8_t>(key & 0x7)};
+    uint64_t const fieldId{key >> 3};
+    if (wireType == 0 && (fieldId == 1 || fieldId == 2)) {
+      uint64_t value{0};
+      if (!readVarInt(p, end, value)) {
+        break;
+      }
+      (fieldId == 1 ? seconds : microseconds) = fromZigZag32(value);
+    } else if (!skipField(p, end, wireType)) {
+      break;
+    }
+  }
+  return static_cast<int64_t>(seconds) * 1000 * 1000 + microseconds;
+}
+
+// Decodes a nested TimeStamp in the same way as decodeEnvelopeFields().
+bool decodeTimeStampFields(char const *p, char const *end, 
+    cluon::data::TimeStamp &timeStamp) noexcept
+{
+  timeStamp = cluon::data::TimeStamp{};
+  while (p < end) {
+    uint64_t key{0};
+    if (!readVarInt(p, end, key)) {
+      return false;
+    }
+    uint8_t const wireType{static_cast<uint8_t>(key & 0x7)};
+    uint64_t const fieldId{key >> 3};
+    if (fieldId == 1 || fieldId == 2) {
+      uint64_t value{0};
+      if (wireType != 0 || !readVarInt(p, end, value)) {
+        return false;
+      }
+      if (fieldId == 1) {
+        timeStamp.seconds(fromZigZag32(value));
+      } else {
+        timeStamp.microseconds(fromZigZag32(value));
+      }
+    } else if (!skipField(p, end, wireType)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
+// Locates the frame at pos in the given bytes and decodes its routing
+// information. Returns false if there is no complete frame at pos.
+bool decodeFrame(char const *data, uint64_t size, uint64_t pos, 
+    EnvelopeSpan &span) noexcept
+{
+  if (pos + OD4_HEADER_SIZE > size) {
+    return false;
+  }
+  uint8_t const *header{reinterpret_cast<uint8_t const *>(data + pos)};
+  if (header[0] != 0x0D || header[1] != 0xA4) {
+    return false;
+  }
+  uint32_t const length{static_cast<uint32_t>(header[2]) 
+    | (static_cast<uint32_t>(header[3]) << 8) 
+    | (static_cast<uint32_t>(header[4]) << 16)};
+  if (pos + OD4_HEADER_SIZE + length > size) {
+    return false;
+  }
+
+  span.offset = pos;
+  span.length = OD4_HEADER_SIZE + length;
+  span.dataType = 0;
+  span.sent = 0;
+  span.received = 0;
+  span.sampleTimeStamp = 0;
+  span.senderStamp = 0;
+  span.serializedDataOffset = OD4_HEADER_SIZE;
+  span.serializedDataLength = 0;
+
+  char const *begin{data + pos + OD4_HEADER_SIZE};
+  char const *p{begin};
+  char const *end{begin + length};
+  while (p < end) {
+    uint64_t key{0};
+    if (!readVarInt(p, end, key)) {
+      break;
+    }
+    uint8_t const wireType{static_cast<uint8_t>(key & 0x7)};
+    uint64_t const fieldId{key >> 3};
+    if (wireType == 0 && (fieldId == 1 || fieldId == 6)) {
+      uint64_t value{0};
+      if (!readVarInt(p, end, value)) {
+        break;
+      }
+      if (fieldId == 1) {
+        span.dataType = fromZigZag32(value);
+      } else {
+        span.senderStamp = static_cast<uint32_t>(value);
+      }
+    } else if (wireType == 2 && fieldId >= 2 && fieldId <= 5) {
+      uint64_t fieldLength{0};
+      if (!readVarInt(p, end, fieldLength) 
+          || fieldLength > static_cast<uint64_t>(end - p)) {
+        break;
+      }
+      if (fieldId == 2) {
+        span.serializedDataOffset = 
+          static_cast<uint32_t>(p - begin) + OD4_HEADER_SIZE;
+        span.serializedDataLength = static_cast<uint32_t>(fieldLength);
+      } else if (fieldId == 3) {
+        span.sent = decodeTimeStamp(p, p + fieldLength);
+      } else if (fieldId == 4) {
+        span.received = decodeTimeStamp(p, p + fieldLength);
+      } else {
+        span.sampleTimeStamp = decodeTimeStamp(p, p + fieldLength);
+      }
+      p += fieldLength;
+    } else if (!skipField(p, end, wireType)) {
+      break;
+    }
+  }
+  return true;
+}
+
+// Decodes the complete Envelope of the given frame.
+cluon::data::Envelope decodeEnvelope(std::string_view frame) noexcept
+{
+  MemoryStreamBuffer buffer(frame.substr(OD4_HEADER_SIZE));
+  std::istream in(&buffer);
+
+  cluon::data::Envelope e;
+  cluon::FromProtoVisitor decoder;
+  decoder.decodeFrom(in, e);
+  return e;
+}
+
+// Decodes all fields of the Envelope of the given frame without copying its
+// serialized data. As for cluon::FromProtoVisitor, the last of repeated
+// fields is used and unknown fields are ignored. Returns false if a known
+// field does not have the expected wire type or the Envelope is truncated,
+// since cluon then decodes stale values, for decodeEnvelope() to be used.
+bool decodeEnvelopeFields(std::string_view frame, EnvelopeFields &fields) 
+  noexcept
+{
+  fields = EnvelopeFields{};
+  if (frame.size() < OD4_HEADER_SIZE) {
+    return false;
+  }
+  char const *p{frame.data() + OD4_HEADER_SIZE};
+  char const *end{frame.data() + frame.size()};
+  while (p < end) {
+    uint64_t key{0};
+    if (!readVarInt(p, end, key)) {
+      return false;
+    }
+    uint8_t const wireType{static_cast<uint8_t>(key & 0x7)};
+    uint64_t const fieldId{key >> 3};
+    if (fieldId == 1 || fieldId == 6) {
+      uint64_t value{0};
+      if (wireType != 0 || !readVarInt(p, end, value)) {
+        return false;
+      }
+      if (fieldId == 1) {
+        fields.dataType = fromZigZag32(value);
+      } else {
+        fields.senderStamp = static_cast<uint32_t>(value);
+      }
+    } else if (fieldId >= 2 && fieldId <= 5) {
+      uint64_t length{0};
+      if (wireType != 2 || !readVarInt(p, end, length) 
+          || length > static_cast<uint64_t>(end - p)) {
+        return false;
+      }
+      if (fieldId == 2) {
+        fields.serializedData = std::string_view(p, length);
+      } else if (!decodeTimeStampFields(p, p + length, fieldId == 3 
+            ? fields.sent : (fieldId == 4 ? fields.received 
+              : fields.sampleTimeStamp))) {
+        return false;
+      }
+      p += length;
+    } else if (!skipField(p, end, wireType)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes a message of float fields with ids 1 to floatCount, followed by
+// uint8 fields with the next ids, as cluon::extractMessage does: the first
+// of repeated fields is used, and fields that are missing or do not have
+// the expected wire type are zero. Decoding stops at a truncated field.
+void decodeReadingFields(std::string_view serializedData, float *floats, 
+    uint32_t floatCount, uint8_t *bytes, uint32_t byteCount) noexcept
+{
+  uint32_t const fieldCount{floatCount + byteCount};
+  uint32_t seen{0};
+  for (uint32_t i{0}; i < floatCount; i++) {
+    floats[i] = 0.0f;
+  }
+  for (uint32_t i{0}; i < byteCount; i++) {
+    bytes[i] = 0;
+  }
+
+  char const *p{serializedData.data()};
+  char const *end{p + serializedData.size()};
+  while (p < end) {
+    uint64_t key{0};
+    if (!readVarInt(p, end, key)) {
+      return;
+    }
+    uint8_t const wireType{static_cast<uint8_t>(key & 0x7)};
+    uint64_t const fieldId{key >> 3};
+    bool const isFirst{fieldId >= 1 && fieldId <= fieldCount 
+      && (seen & (1U << (fieldId - 1))) == 0};
+    if (isFirst) {
+      seen |= 1U << (fieldId - 1);
+    }
+    if (isFirst && fieldId <= floatCount && wireType == 5) {
+      if (end - p < 4) {
+        return;
+      }
+      floats[fieldId - 1] = readFloat(p);
+      p += 4;
+    } else if (isFirst && fieldId > floatCount && wireType == 0) {
+      uint64_t value{0};
+      if (!readVarInt(p, end, value)) {
+        return;
+      }
+      bytes[fieldId - floatCount - 1] = static_cast<uint8_t>(value);
+    } else if (!skipField(p, end, wireType)) {
+      return;
+    }
+  }
+}
+
+// Finds where the 4 bytes of each of the given float fields are in the
+// serialized message. If a field occurs more than once the first one is
+// used, as by cluon::FromProtoVisitor. Returns false if any field is
+// missing or is not encoded as four bytes.
+bool locateFloatFields(std::string_view serializedData, 
+    uint32_t const *fieldIds, uint32_t *offsets, uint32_t count) noexcept
+{
+  uint32_t found{0};
+  for (uint32_t i{0}; i < count; i++) {
+    offsets[i] = 0;
+  }
+
+  char const *begin{serializedData.data()};
+  char const *p{begin};
+  char const *end{begin + serializedData.size()};
+  while (p < end && found < count) {
+    uint64_t key{0};
+    if (!readVarInt(p, end, key)) {
+      return false;
+    }
+    uint8_t const wireType{static_cast<uint8_t>(key & 0x7)};
+    uint64_t const fieldId{key >> 3};
+    for (uint32_t i{0}; i < count; i++) {
+      if (fieldIds[i] == fieldId && offsets[i] == 0) {
+        if (wireType != 5 || end - p < 4) {
+          return false;
+        }
+        offsets[i] = static_cast<uint32_t>(p - begin);
+        found++;
+      }
+    }
+    if (!skipField(p, end, wireType)) {
+      return false;
+    }
+  }
+  return found == count;
+}
+
+RecFileView::RecFileView(std::string const &filename) noexcept:
+  m_data{nullptr},
+  m_size{0},
+  m_isValid{false}
+{
+  int fd{::open(filename.c_str(), O_RDONLY)};
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) == 0) {
+    m_size = static_cast<uint64_t>(st.st_size);
+    if (m_size == 0) {
+      m_isValid = true;
+    } else {
+      void *addr{::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+      if (addr != MAP_FAILED) {
+        m_data = static_cast<char *>(addr);
+        m_isValid = true;
+        ::madvise(m_data, m_size, MADV_SEQUENTIAL);
+      }
+    }
+  }
+  ::close(fd);
+}
+
+RecFileView::~RecFileView()
+{
+  if (m_data != nullptr) {
+    ::munmap(m_data, m_size);
+  }
+}
+
+bool RecFileView::isValid() const noexcept
+{
+  return m_isValid;
+}
+
+uint64_t RecFileView::size() const noexcept
+{
+  return m_size;
+}
+
+char const *RecFileView::data() const noexcept
+{
+  return m_data;
+}
+
+// Asks the kernel to read the whole file ahead, for when all of it will be
+// accessed, and possibly out of order.
+void RecFileView::willNeed() const noexcept
+{
+  if (m_data != nullptr) {
+    ::madvise(m_data, m_size, MADV_WILLNEED);
+  }
+}
+
+// Finds the next valid frame at or after pos, and moves pos past it.
+// Invalid headers are skipped in the same way as cluon::extractEnvelope
+// does when reading a stream. Returns false at the end of the file.
+bool RecFileView::next(uint64_t &pos, EnvelopeSpan &span) const noexcept
+{
+  while (pos + OD4_HEADER_SIZE <= m_size) {
+    if (spanAt(pos, span)) {
+      pos += span.length;
+      return true;
+    }
+    uint8_t const *header{reinterpret_cast<uint8_t const *>(m_data + pos)};
+    if (header[0] == 0x0D && header[1] == 0xA4) {
+      // Valid header, but the frame is truncated.
+      break;
+    }
+    pos += OD4_HEADER_SIZE;
+  }
+  pos = m_size;
+  return false;
+}
+
+bool RecFileView::spanAt(uint64_t pos, EnvelopeSpan &span) const noexcept
+{
+  return decodeFrame(m_data, m_size, pos, span);
+}
+
+// Finds the first position from pos, but before end, that looks like the
+// start of a frame followed by another one or by the end of the file, for
+// starting to read in the middle of a file. This is only a guess, since
+// frame headers may as well be part of the payload of another frame.
+// Returns end, or the file size if less, if there is none.
+uint64_t RecFileView::findFrame(uint64_t pos, uint64_t end) const noexcept
+{
+  end = std::min(end, m_size);
+  EnvelopeSpan span;
+  EnvelopeSpan nextSpan;
+  for (; pos < end; pos++) {
+    if (spanAt(pos, span)) {
+      uint64_t const nextPos{pos + span.length};
+      if (nextPos == m_size || spanAt(nextPos, nextSpan)) {
+        return pos;
+      }
+    }
+  }
+  return end;
+}
+
+std::string_view RecFileView::frame(EnvelopeSpan const &span) const noexcept
+{
+  return std::string_view(m_data + span.offset, span.length);
+}
+
+std::string_view RecFileView::serializedData(
+    EnvelopeSpan const &span) const noexcept
+{
+  return std::string_view(m_data + span.offset + span.serializedDataOffset, 
+      span.serializedDataLength);
+}
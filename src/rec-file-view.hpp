@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REC_FILE_VIEW_HPP
+#define REC_FILE_VIEW_HPP
+
+#include "cluon-complete.hpp"
+
+#include <cstdint>
+#include <istream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+// Location and routing information of one OD4 frame in a .rec file:
+//
+//    0x0D 0xA4 LEN0 LEN1 LEN2 Proto-encoded cluon::data::Envelope
+//
+// All of the Envelope but its serialized data, with the time stamps in 
+// microseconds, as needed to route and order it.
+struct EnvelopeSpan {
+  uint64_t offset;
+  uint32_t length;
+  int32_t dataType;
+  int64_t sent;
+  int64_t received;
+  int64_t sampleTimeStamp;
+  uint32_t senderStamp;
+  uint32_t serializedDataOffset;
+  uint32_t serializedDataLength;
+};
+
+// The fields of an Envelope as decoded by cluon, except that the serialized
+// data refers to the bytes of the frame rather than being copied.
+struct EnvelopeFields {
+  int32_t dataType{0};
+  std::string_view serializedData{};
+  cluon::data::TimeStamp sent{};
+  cluon::data::TimeStamp received{};
+  cluon::data::TimeStamp sampleTimeStamp{};
+  uint32_t senderStamp{0};
+};
+
+// Read-only view of a memory mapped .rec file. The OD4 frames are located
+// directly in the mapped bytes, so Envelopes are only decoded when their
+// payload is actually needed.
+class RecFileView {
+ public:
+  RecFileView(std::string const &) noexcept;
+  ~RecFileView();
+
+ private:
+  RecFileView(RecFileView const &) = delete;
+  RecFileView(RecFileView &&) = delete;
+  RecFileView &operator=(RecFileView const &) = delete;
+  RecFileView &operator=(RecFileView &&) = delete;
+
+ public:
+  bool isValid() const noexcept;
+  uint64_t size() const noexcept;
+  char const *data() const noexcept;
+  void willNeed() const noexcept;
+
+  bool next(uint64_t &, EnvelopeSpan &) const noexcept;
+  bool spanAt(uint64_t, EnvelopeSpan &) const noexcept;
+  uint64_t findFrame(uint64_t, uint64_t) const noexcept;
+  std::string_view frame(EnvelopeSpan const &) const noexcept;
+  std::string_view serializedData(EnvelopeSpan const &) const noexcept;
+
+ private:
+  char *m_data;
+  uint64_t m_size;
+  bool m_isValid;
+};
+
+bool decodeFrame(char const *, uint64_t, uint64_t, EnvelopeSpan &) noexcept;
+cluon::data::Envelope decodeEnvelope(std::string_view) noexcept;
+bool decodeEnvelopeFields(std::string_view, EnvelopeFields &) noexcept;
+void decodeReadingFields(std::string_view, float *, uint32_t, uint8_t *, 
+    uint32_t) noexcept;
+bool locateFloatFields(std::string_view, uint32_t const *, uint32_t *, 
+    uint32_t) noexcept;
+
+// Read-only stream buffer over bytes already in memory, so that the cluon
+// decoders can be used without copying the bytes into a std::stringstream.
+class MemoryStreamBuffer : public std::streambuf {
+ public:
+  MemoryStreamBuffer(std::string_view bytes) noexcept:
+    std::streambuf()
+  {
+    char *data{const_cast<char *>(bytes.data())};
+    setg(data, data, data + bytes.size());
+  }
+};
+
+#endif
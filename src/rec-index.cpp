@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rec-file-view.hpp"
+#include "rec-index.hpp"
+
+#include <cstring>
+#include <filesystem>
+
+#include <endian.h>
+
+namespace {
+
+constexpr char INDEX_MAGIC[8]{'P', 'E', 'A', 'K', 'I', 'D', 'X', '1'};
+constexpr uint32_t ENTRY_SIZE{28};
+constexpr uint32_t FOOTER_SIZE{24};
+
+template <typename T>
+void put(char *&p, T v) noexcept
+{
+  if constexpr (sizeof(T) == 8) {
+    uint64_t u;
+    std::memcpy(&u, &v, 8);
+    u = htole64(u);
+    std::memcpy(p, &u, 8);
+  } else {
+    uint32_t u;
+    std::memcpy(&u, &v, 4);
+    u = htole32(u);
+    std::memcpy(p, &u, 4);
+  }
+  p += sizeof(T);
+}
+
+template <typename T>
+T get(char const *&p) noexcept
+{
+  T v;
+  if constexpr (sizeof(T) == 8) {
+    uint64_t u;
+    std::memcpy(&u, p, 8);
+    u = le64toh(u);
+    std::memcpy(&v, &u, 8);
+  } else {
+    uint32_t u;
+    std::memcpy(&u, p, 4);
+    u = le32toh(u);
+    std::memcpy(&v, &u, 4);
+  }
+  p += sizeof(T);
+  return v;
+}
+
+}
+
+RecIndexWriter::RecIndexWriter(std::string const &filename):
+  m_sink{filename, 1024 * 1024, false},
+  m_entryCount{0}
+{
+}
+
+bool RecIndexWriter::isGood() const noexcept
+{
+  return m_sink.isGood();
+}
+
+// Entries must be added in ascending sampleTimeStamp order.
+void RecIndexWriter::add(IndexEntry const &entry) noexcept
+{
+  char buffer[ENTRY_SIZE];
+  char *p{buffer};
+  put(p, entry.sampleTimeStamp);
+  put(p, entry.offset);
+  put(p, entry.length);
+  put(p, entry.dataType);
+  put(p, entry.senderStamp);
+  m_sink.write(std::string_view(buffer, ENTRY_SIZE));
+  m_entryCount++;
+}
+
+bool RecIndexWriter::close(uint64_t recFileSize) noexcept
+{
+  char buffer[FOOTER_SIZE];
+  char *p{buffer};
+  put(p, m_entryCount);
+  put(p, recFileSize);
+  std::memcpy(p, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  m_sink.write(std::string_view(buffer, FOOTER_SIZE));
+  return m_sink.close();
+}
+
+// Reads the sidecar index of a .rec file. Returns false if there is none,
+// or if it does not match the .rec file, e.g., since the .rec file was
+// changed after the index was written.
+bool readRecIndex(std::string const &recFilename, uint64_t recFileSize, 
+    std::vector<IndexEntry> &entries)
+{
+  std::string const indexFilename{recFilename + ".idx"};
+  std::error_code ec;
+  if (!std::filesystem::exists(indexFilename, ec) 
+      || std::filesystem::last_write_time(indexFilename, ec) 
+      < std::filesystem::last_write_time(recFilename, ec) || ec) {
+    return false;
+  }
+
+  RecFileView view(indexFilename);
+  if (!view.isValid() || view.size() < FOOTER_SIZE) {
+    return false;
+  }
+  char const *p{view.data() + view.size() - FOOTER_SIZE};
+  uint64_t const entryCount{get<uint64_t>(p)};
+  uint64_t const indexedFileSize{get<uint64_t>(p)};
+  if (std::memcmp(p, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 
+      || indexedFileSize != recFileSize
+      || entryCount * ENTRY_SIZE + FOOTER_SIZE != view.size()) {
+    return false;
+  }
+
+  entries.resize(entryCount);
+  p = view.data();
+  for (auto &entry : entries) {
+    entry.sampleTimeStamp = get<int64_t>(p);
+    entry.offset = get<uint64_t>(p);
+    entry.length = get<uint32_t>(p);
+    entry.dataType = get<int32_t>(p);
+    entry.senderStamp = get<uint32_t>(p);
+    if (entry.offset + entry.length > recFileSize) {
+      entries.clear();
+      return false;
+    }
+  }
+  return true;
+}
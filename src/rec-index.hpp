@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REC_INDEX_HPP
+#define REC_INDEX_HPP
+
+#include "output-sink.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One entry of a .rec.idx sidecar file, which lists the Envelopes of a .rec
+// file in ascending sampleTimeStamp order. Each entry is stored as 28
+// little endian bytes, in the order of the fields below, followed by a
+// footer of the entry count, the size of the .rec file, and a magic value.
+struct IndexEntry {
+  int64_t sampleTimeStamp;
+  uint64_t offset;
+  uint32_t length;
+  int32_t dataType;
+  uint32_t senderStamp;
+};
+
+class RecIndexWriter {
+ public:
+  RecIndexWriter(std::string const &);
+  ~RecIndexWriter() = default;
+
+ private:
+  RecIndexWriter(RecIndexWriter const &) = delete;
+  RecIndexWriter(RecIndexWriter &&) = delete;
+  RecIndexWriter &operator=(RecIndexWriter const &) = delete;
+  RecIndexWriter &operator=(RecIndexWriter &&) = delete;
+
+ public:
+  bool isGood() const noexcept;
+  void add(IndexEntry const &) noexcept;
+  bool close(uint64_t) noexcept;
+
+ private:
+  OutputSink m_sink;
+  uint64_t m_entryCount;
+};
+
+bool readRecIndex(std::string const &, uint64_t, std::vector<IndexEntry> &);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rewrite-pipeline.hpp"
+
+namespace {
+
+// Enough frames to keep the transform thread busy while the reader waits
+// for the disk, and enough batches for the writer.
+constexpr size_t FRAME_RING_SIZE{4096};
+constexpr size_t BATCH_RING_SIZE{4};
+
+}
+
+RewritePipeline::RewritePipeline(EnvelopeTransformer &transformer, 
+    OutputSink &sink):
+  m_transformer{transformer},
+  m_sink{sink},
+  m_frames{FRAME_RING_SIZE},
+  m_batches{BATCH_RING_SIZE},
+  m_error{},
+  m_transformThread{},
+  m_writeThread{}
+{
+  m_transformThread = std::thread(&RewritePipeline::transformFrames, this);
+  m_writeThread = std::thread(&RewritePipeline::writeBatches, this);
+}
+
+RewritePipeline::~RewritePipeline()
+{
+  m_frames.close();
+  if (m_transformThread.joinable()) {
+    m_transformThread.join();
+  }
+  if (m_writeThread.joinable()) {
+    m_writeThread.join();
+  }
+}
+
+void RewritePipeline::push(std::string_view frame, EnvelopeSpan const &span) 
+  noexcept
+{
+  Frame f{frame, span};
+  m_frames.push(f);
+}
+
+// Waits until all pushed frames are written. Rethrows any exception from
+// the transform stage.
+void RewritePipeline::finish()
+{
+  m_frames.close();
+  m_transformThread.join();
+  m_writeThread.join();
+  if (m_error) {
+    std::rethrow_exception(m_error);
+  }
+}
+
+void RewritePipeline::transformFrames() noexcept
+{
+  auto consume{[this](EnvelopeTransformer::Batch &batch) {
+      m_batches.push(batch);
+    }};
+  Frame f{};
+  try {
+    while (m_frames.pop(f)) {
+      m_transformer.push(f.frame, f.span, consume);
+    }
+    m_transformer.flush(consume);
+  } catch (...) {
+    m_error = std::current_exception();
+    // Keep taking frames so that the reader is not blocked.
+    while (m_frames.pop(f)) {
+    }
+  }
+  m_batches.close();
+}
+
+void RewritePipeline::writeBatches() noexcept
+{
+  EnvelopeTransformer::Batch batch{};
+  while (m_batches.pop(batch)) {
+    m_transformer.writeBatch(batch, m_sink);
+  }
+}
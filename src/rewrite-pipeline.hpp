@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REWRITE_PIPELINE_HPP
+#define REWRITE_PIPELINE_HPP
+
+#include "envelope-transformer.hpp"
+#include "output-sink.hpp"
+#include "rec-file-view.hpp"
+#include "spsc-ring.hpp"
+
+#include <exception>
+#include <string_view>
+#include <thread>
+
+// Runs the rewrite of a recording as three stages connected by ring
+// buffers, each on its own thread: the calling thread reads the frames in
+// output order and pushes them, a transform thread decodes, transforms, and
+// batches them, and a write thread corrects the float fields of each batch
+// and writes it. Frames are passed by reference, so they must stay valid
+// until finish() returns.
+class RewritePipeline {
+ private:
+  struct Frame {
+    std::string_view frame{};
+    EnvelopeSpan span{};
+  };
+
+ public:
+  RewritePipeline(EnvelopeTransformer &, OutputSink &);
+  ~RewritePipeline();
+
+ private:
+  RewritePipeline(RewritePipeline const &) = delete;
+  RewritePipeline(RewritePipeline &&) = delete;
+  RewritePipeline &operator=(RewritePipeline const &) = delete;
+  RewritePipeline &operator=(RewritePipeline &&) = delete;
+
+ public:
+  void push(std::string_view, EnvelopeSpan const &) noexcept;
+  void finish();
+
+ private:
+  void transformFrames() noexcept;
+  void writeBatches() noexcept;
+
+ private:
+  EnvelopeTransformer &m_transformer;
+  OutputSink &m_sink;
+  SpscRing<Frame> m_frames;
+  SpscRing<EnvelopeTransformer::Batch> m_batches;
+  std::exception_ptr m_error;
+  std::thread m_transformThread;
+  std::thread m_writeThread;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "run-journal.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr char JOURNAL_HEADER[]{"peak-reencode journal 2"};
+constexpr size_t FIELD_COUNT{4};
+
+}
+
+RunJournal::RunJournal(std::string const &filename, 
+    std::string const &inFolder, std::string const &outFolder):
+  m_mutex{},
+  m_entries{},
+  m_file{},
+  m_isForOtherFolders{false}
+{
+  // The header names the folders that the recordings are relative to.
+  std::string const firstLine{std::string(JOURNAL_HEADER) + "\n"};
+  std::string const header{firstLine + "in\t" + inFolder + "\nout\t" 
+    + outFolder + "\n"};
+  size_t const headerLineCount{3};
+
+  // A file that is not a journal, or the journal of other folders, is left
+  // as it is, and the journal is then not good. One with only part of the
+  // header was cut short when created, before any file was finished.
+  bool isEmpty{true};
+  bool hasHeader{false};
+  uint64_t completeSize{0};
+  bool isTorn{false};
+  {
+    std::ifstream in(filename);
+    std::string start;
+    std::string line;
+    for (size_t i{0}; i < headerLineCount && std::getline(in, line); i++) {
+      start += line;
+      if (!in.eof()) {
+        start += '\n';
+      }
+    }
+    bool const isJournal{start.compare(0, firstLine.size(), firstLine) == 0};
+    hasHeader = (start == header);
+    isEmpty = (!hasHeader && header.compare(0, start.size(), start) == 0);
+    m_isForOtherFolders = (isJournal && !hasHeader && !isEmpty);
+    if (hasHeader) {
+      completeSize = static_cast<uint64_t>(in.tellg());
+    }
+    while (hasHeader && std::getline(in, line)) {
+      // A last line without a newline was cut short when the run was
+      // interrupted, and is dropped.
+      if (in.eof()) {
+        isTorn = true;
+        break;
+      }
+      completeSize = static_cast<uint64_t>(in.tellg());
+      size_t const tab{line.find('\t')};
+      if (tab == std::string::npos) {
+        continue;
+      }
+      std::istringstream fields(line.substr(0, tab));
+      std::vector<std::string> f;
+      std::string field;
+      while (fields >> field) {
+        f.push_back(field);
+      }
+      if (f.size() != FIELD_COUNT) {
+        continue;
+      }
+      auto toUint{[](std::string const &s) { 
+          return std::strtoull(s.c_str(), nullptr, 10); 
+        }};
+      m_entries[line.substr(tab + 1)] = JournalEntry{toUint(f[0]), 
+        toUint(f[1]), toUint(f[2]), toUint(f[3])};
+    }
+  }
+
+  if (hasHeader) {
+    std::error_code ec;
+    if (isTorn) {
+      std::filesystem::resize_file(filename, completeSize, ec);
+    }
+    if (!ec) {
+      m_file.open(filename, std::ios::app);
+    }
+  } else if (isEmpty) {
+    m_file.open(filename, std::ios::trunc);
+    m_file << header << std::flush;
+  }
+}
+
+bool RunJournal::isGood() const noexcept
+{
+  return m_file.is_open() && m_file.good();
+}
+
+// True if the file is the journal of other input or output folders.
+bool RunJournal::isForOtherFolders() const noexcept
+{
+  return m_isForOtherFolders;
+}
+
+uint64_t RunJournal::size() const noexcept
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.size();
+}
+
+// True if the recording was finished by an earlier run, and its input has
+// not changed size since.
+bool RunJournal::isDone(std::string const &filename, uint64_t inSize) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto const entry{m_entries.find(filename)};
+  return entry != m_entries.end() && entry->second.inSize == inSize;
+}
+
+void RunJournal::record(std::string const &filename, 
+    JournalEntry const &entry)
+{
+  if (filename.find('\n') != std::string::npos) {
+    return;
+  }
+
+  std::ostringstream line;
+  line << entry.inSize << ' ' << entry.inHash << ' ' << entry.outSize << ' ' 
+    << entry.outHash << '\t' << filename << '\n';
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries[filename] = entry;
+  m_file << line.str() << std::flush;
+}
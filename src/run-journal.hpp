@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RUN_JOURNAL_HPP
+#define RUN_JOURNAL_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// What was read and written for a finished recording, with content hashes
+// as in RecFileKey.
+struct JournalEntry {
+  uint64_t inSize;
+  uint64_t inHash;
+  uint64_t outSize;
+  uint64_t outHash;
+};
+
+// A persistent record of the recordings finished by earlier runs, kept as
+// one line of text per recording, relative to the input and output
+// folders named in its header. Recordings are appended once their output
+// is in place, so that a run that was interrupted resumes with the first
+// unfinished recording. A finished recording is taken as it is, without
+// reading the files again, as long as its input has the same size. A file
+// is only created if missing or empty, and one that is not a journal, or
+// the journal of other folders, is never overwritten. Shared between all
+// workers.
+class RunJournal {
+ public:
+  RunJournal(std::string const &, std::string const &, std::string const &);
+  ~RunJournal() = default;
+
+ private:
+  RunJournal(RunJournal const &) = delete;
+  RunJournal(RunJournal &&) = delete;
+  RunJournal &operator=(RunJournal const &) = delete;
+  RunJournal &operator=(RunJournal &&) = delete;
+
+ public:
+  bool isGood() const noexcept;
+  bool isForOtherFolders() const noexcept;
+  uint64_t size() const noexcept;
+  bool isDone(std::string const &, uint64_t) const;
+  void record(std::string const &, JournalEntry const &);
+
+ private:
+  mutable std::mutex m_mutex;
+  std::unordered_map<std::string, JournalEntry> m_entries;
+  std::ofstream m_file;
+  bool m_isForOtherFolders;
+};
+
+#endif
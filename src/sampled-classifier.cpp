@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "opendlv-standard-message-set.hpp"
+
+#include "sampled-classifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Windows and readings needed before the spread of the window means tells
+// anything.
+uint32_t const MIN_WINDOWS{8};
+uint64_t const MIN_READINGS{256};
+
+// Standard errors between the mean length and the nearest threshold for the
+// classification to be settled, i.e., a confidence of about 0.99994.
+double const SETTLED_Z{4.0};
+
+// The position of window i in [0, 1), as the bits of i reversed behind the
+// binary point.
+double radicalInverse(uint32_t i) noexcept
+{
+  double position{0.0};
+  double scale{0.5};
+  for (; i != 0; i >>= 1) {
+    if ((i & 1) != 0) {
+      position += scale;
+    }
+    scale *= 0.5;
+  }
+  return position;
+}
+
+}
+
+SampledClassifier::SampledClassifier(RecFileView const &view, 
+    uint32_t windowCount, uint64_t windowSize) noexcept:
+  m_view{view},
+  m_windowCount{windowCount},
+  m_windowSize{std::max<uint64_t>(windowSize, 1)},
+  m_classifier{},
+  m_windowMeans{},
+  m_confidence{0.0},
+  m_windowsRead{0},
+  m_unsettledReason{"not sampled"}
+{
+}
+
+// Reads windows until the classification is settled, and returns true if it
+// is. Otherwise, a full scan is needed. The windows may not cover more than
+// half of the file, since sampling would not save much reading then.
+bool SampledClassifier::classify()
+{
+  if (m_windowCount < MIN_WINDOWS) {
+    m_unsettledReason = "fewer than 8 windows asked for";
+    return false;
+  }
+  // Divided rather than multiplied, since the window size may be as large
+  // as any file.
+  if (m_windowSize > m_view.size() / 2 / m_windowCount) {
+    m_unsettledReason = "the windows would cover more than half of the file";
+    return false;
+  }
+  // The windows do not overlap, since the first n positions are at least
+  // 1/2n apart.
+  double const span{static_cast<double>(m_view.size() - m_windowSize)};
+  while (m_windowsRead < m_windowCount) {
+    uint64_t const begin{static_cast<uint64_t>(
+        radicalInverse(m_windowsRead) * span)};
+    readWindow(begin, begin + m_windowSize);
+    m_windowsRead++;
+
+    AccelerationStatistics const statistics{m_classifier.statistics()};
+    if (statistics.sampleCount > 0 
+        && m_classifier.classification().isFromBrokenPatch) {
+      m_confidence = 1.0;
+      return true;
+    }
+    updateConfidence();
+    if (m_windowsRead >= MIN_WINDOWS && statistics.sampleCount >= MIN_READINGS
+        && m_confidence >= std::erf(SETTLED_Z / std::sqrt(2.0))) {
+      return true;
+    }
+  }
+  uint64_t const sampleCount{m_classifier.statistics().sampleCount};
+  if (sampleCount == 0) {
+    m_unsettledReason = "no AccelerationReadings in the windows";
+  } else if (sampleCount < MIN_READINGS) {
+    m_unsettledReason = "too few AccelerationReadings in the windows";
+  } else {
+    m_unsettledReason = "the mean length is too close to a threshold";
+  }
+  return false;
+}
+
+Classifier const &SampledClassifier::classifier() const noexcept
+{
+  return m_classifier;
+}
+
+// The probability that the mean length of the whole recording is on the
+// same side of the thresholds as the sampled mean.
+double SampledClassifier::confidence() const noexcept
+{
+  return m_confidence;
+}
+
+uint32_t SampledClassifier::windowsRead() const noexcept
+{
+  return m_windowsRead;
+}
+
+// Why classify() returned false, if it did.
+char const *SampledClassifier::unsettledReason() const noexcept
+{
+  return m_unsettledReason;
+}
+
+// Adds the AccelerationReadings of the frames starting from the first frame
+// found after begin, and before end.
+void SampledClassifier::readWindow(uint64_t begin, uint64_t end)
+{
+  uint64_t pos{m_view.findFrame(begin, end)};
+  Classifier window;
+  EnvelopeSpan span;
+  while (pos < end && m_view.next(pos, span)) {
+    window.add(span.dataType, m_view.serializedData(span));
+  }
+  AccelerationStatistics const statistics{window.statistics()};
+  if (statistics.sampleCount > 0) {
+    m_windowMeans.push_back(statistics.lengthMean);
+    m_classifier.combine(window);
+  }
+}
+
+void SampledClassifier::updateConfidence() noexcept
+{
+  size_t const n{m_windowMeans.size()};
+  if (n < 2) {
+    m_confidence = 0.0;
+    return;
+  }
+  double meanOfMeans{0.0};
+  for (double const mean : m_windowMeans) {
+    meanOfMeans += mean;
+  }
+  meanOfMeans /= n;
+  double squareSum{0.0};
+  for (double const mean : m_windowMeans) {
+    squareSum += (mean - meanOfMeans) * (mean - meanOfMeans);
+  }
+  double const standardError{std::sqrt(squareSum / (n - 1) / n)};
+
+  double const lengthMean{m_classifier.statistics().lengthMean};
+  double const distance{std::min(std::abs(lengthMean - 1000.0), 
+      std::abs(lengthMean - 1060.0))};
+  if (!(standardError > 0.0)) {
+    m_confidence = (distance > 0.0) ? 1.0 : 0.0;
+    return;
+  }
+  m_confidence = std::erf(distance / (standardError * std::sqrt(2.0)));
+}
+
+SampleVerifier::SampleVerifier(Classification const &classification) 
+  noexcept:
+  m_classification{classification},
+  m_classifier{},
+  m_lastTimeStamp{0},
+  m_isFirst{true}
+{
+}
+
+// Returns false if the classification cannot hold, whatever frames follow.
+bool SampleVerifier::add(EnvelopeSpan const &span, 
+    std::string_view serializedData)
+{
+  if (!m_isFirst && span.sampleTimeStamp < m_lastTimeStamp) {
+    return false;
+  }
+  m_isFirst = false;
+  m_lastTimeStamp = span.sampleTimeStamp;
+  if (span.dataType != opendlv::proxy::AccelerationReading::ID()) {
+    return true;
+  }
+  m_classifier.add(span.dataType, serializedData);
+  return m_classification.isFromBrokenPatch 
+    || !m_classifier.classification().isFromBrokenPatch;
+}
+
+// Once all frames are added, returns true if the classification is the one
+// found from all AccelerationReadings.
+bool SampleVerifier::holds() const noexcept
+{
+  Classification const c{m_classifier.classification()};
+  return c.isBeforeSiPatch == m_classification.isBeforeSiPatch 
+    && c.isFromBrokenPatch == m_classification.isFromBrokenPatch 
+    && c.removeSwitchStateReadings 
+    == m_classification.removeSwitchStateReadings 
+    && c.isFine == m_classification.isFine;
+}
+
+Classifier const &SampleVerifier::classifier() const noexcept
+{
+  return m_classifier;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SAMPLED_CLASSIFIER_HPP
+#define SAMPLED_CLASSIFIER_HPP
+
+#include "classifier.hpp"
+#include "rec-file-view.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Classifies a recording from strided windows of it rather than from all of
+// its AccelerationReadings. The windows are read in an order that spreads
+// them evenly over the file however many have been read (0, 1/2, 1/4, 3/4,
+// ...), so that sampling can stop as soon as the classification is settled:
+//
+//  - a jump in the readings of a window is certain to be found by a full
+//    scan as well, so that the broken patch is settled at once, and
+//  - otherwise the mean acceleration length must be far enough from both
+//    thresholds compared to the standard error of the mean. The error is
+//    found from the means of the windows, since readings next to each other
+//    are not independent.
+//
+// A recording without AccelerationReadings in the windows read is never
+// settled, since it may need no changes at all.
+//
+// A settled classification is only a prediction. It saves the scan before
+// the rewrite, which then checks it with a SampleVerifier, so that the file
+// is only read once unless the prediction fails.
+class SampledClassifier {
+ public:
+  SampledClassifier(RecFileView const &, uint32_t, uint64_t) noexcept;
+  ~SampledClassifier() = default;
+
+ private:
+  SampledClassifier(SampledClassifier const &) = delete;
+  SampledClassifier(SampledClassifier &&) = delete;
+  SampledClassifier &operator=(SampledClassifier const &) = delete;
+  SampledClassifier &operator=(SampledClassifier &&) = delete;
+
+ public:
+  bool classify();
+  Classifier const &classifier() const noexcept;
+  double confidence() const noexcept;
+  uint32_t windowsRead() const noexcept;
+  char const *unsettledReason() const noexcept;
+
+ private:
+  void readWindow(uint64_t, uint64_t);
+  void updateConfidence() noexcept;
+
+ private:
+  RecFileView const &m_view;
+  uint32_t const m_windowCount;
+  uint64_t const m_windowSize;
+  Classifier m_classifier;
+  std::vector<double> m_windowMeans;
+  double m_confidence;
+  uint32_t m_windowsRead;
+  char const *m_unsettledReason;
+};
+
+// Checks, while a recording classified from samples is rewritten in one
+// pass in file order, that it is in time order and that all of its
+// AccelerationReadings give the same classification, i.e., that the scan
+// that was skipped would have found the same. The check fails as soon as
+// an Envelope is out of order or a jump is found, and otherwise once all
+// frames have been added.
+class SampleVerifier {
+ public:
+  SampleVerifier(Classification const &) noexcept;
+  ~SampleVerifier() = default;
+
+ public:
+  bool add(EnvelopeSpan const &, std::string_view);
+  bool holds() const noexcept;
+  Classifier const &classifier() const noexcept;
+
+ private:
+  Classification const m_classification;
+  Classifier m_classifier;
+  int64_t m_lastTimeStamp;
+  bool m_isFirst;
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Waiting is done by spinning for a short while and then
+// sleeping, so that a stalled stage does not hold on to a core. The
+// producer closes the ring when done; the consumer then gets the remaining
+// items before pop() returns false.
+template <typename T>
+class SpscRing {
+ public:
+  SpscRing(size_t) noexcept;
+  ~SpscRing() = default;
+
+ private:
+  SpscRing(SpscRing const &) = delete;
+  SpscRing(SpscRing &&) = delete;
+  SpscRing &operator=(SpscRing const &) = delete;
+  SpscRing &operator=(SpscRing &&) = delete;
+
+ public:
+  bool tryPush(T &) noexcept;
+  bool tryPop(T &) noexcept;
+  void push(T &) noexcept;
+  bool pop(T &) noexcept;
+  void close() noexcept;
+
+ private:
+  static void wait(uint32_t &) noexcept;
+
+ private:
+  std::vector<T> m_slots;
+  size_t const m_mask;
+  alignas(64) std::atomic<size_t> m_head;
+  alignas(64) std::atomic<size_t> m_tail;
+  std::atomic<bool> m_isClosed;
+};
+
+// The capacity is rounded up to a power of two.
+template <typename T>
+SpscRing<T>::SpscRing(size_t capacity) noexcept:
+  m_slots(size_t{1} << (capacity > 1 ? 64 - __builtin_clzll(capacity - 1) : 0)),
+  m_mask{m_slots.size() - 1},
+  m_head{0},
+  m_tail{0},
+  m_isClosed{false}
+{
+}
+
+// Moves the item into the ring unless it is full. The item is swapped with
+// the slot, so that the producer gets back what the consumer left there,
+// which allows buffers to be reused rather than reallocated.
+template <typename T>
+bool SpscRing<T>::tryPush(T &item) noexcept
+{
+  size_t const tail{m_tail.load(std::memory_order_relaxed)};
+  if (tail - m_head.load(std::memory_order_acquire) == m_slots.size()) {
+    return false;
+  }
+  std::swap(m_slots[tail & m_mask], item);
+  m_tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+// Moves the oldest item out of the ring, by swapping with the given item,
+// unless the ring is empty.
+template <typename T>
+bool SpscRing<T>::tryPop(T &item) noexcept
+{
+  size_t const head{m_head.load(std::memory_order_relaxed)};
+  if (head == m_tail.load(std::memory_order_acquire)) {
+    return false;
+  }
+  std::swap(m_slots[head & m_mask], item);
+  m_head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+void SpscRing<T>::push(T &item) noexcept
+{
+  uint32_t attempts{0};
+  while (!tryPush(item)) {
+    wait(attempts);
+  }
+}
+
+// Waits for the next item. Returns false once the ring is closed and empty.
+template <typename T>
+bool SpscRing<T>::pop(T &item) noexcept
+{
+  uint32_t attempts{0};
+  while (!tryPop(item)) {
+    if (m_isClosed.load(std::memory_order_acquire)) {
+      return tryPop(item);
+    }
+    wait(attempts);
+  }
+  return true;
+}
+
+template <typename T>
+void SpscRing<T>::close() noexcept
+{
+  m_isClosed.store(true, std::memory_order_release);
+}
+
+template <typename T>
+void SpscRing<T>::wait(uint32_t &attempts) noexcept
+{
+  if (attempts < 64) {
+    attempts++;
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stage-stats.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+
+namespace {
+
+constexpr std::array<Stage, STAGE_COUNT> STAGES{Stage::Analysis, 
+  Stage::Index, Stage::Rewrite, Stage::Correct, Stage::Write, Stage::Copy};
+
+void writeString(std::ostream &out, std::string const &str)
+{
+  out << '"';
+  for (char const c : str) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') 
+        << static_cast<int>(c) << std::dec << std::setfill(' ');
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+void writeSeconds(std::ostream &out, char const *name, uint64_t time)
+{
+  out << '"' << name << "\": " << std::fixed << std::setprecision(6) 
+    << static_cast<double>(time) / 1e9;
+}
+
+// The amounts and times of a recording or of the run, with the total time
+// given the name of what it is.
+void writeCounts(std::ostream &out, char const *indent, uint64_t inBytes, 
+    uint64_t outBytes, uint64_t envelopeCount, char const *totalName, 
+    uint64_t totalTime, std::array<uint64_t, STAGE_COUNT> const &times)
+{
+  out << indent << "\"inBytes\": " << inBytes << ",\n" 
+    << indent << "\"outBytes\": " << outBytes << ",\n" 
+    << indent << "\"envelopes\": " << envelopeCount << ",\n" 
+    << indent << "\"seconds\": {";
+  writeSeconds(out, totalName, totalTime);
+  for (Stage const stage : STAGES) {
+    out << ", ";
+    writeSeconds(out, stageName(stage), times[static_cast<size_t>(stage)]);
+  }
+  out << "}\n";
+}
+
+}
+
+char const *stageName(Stage stage) noexcept
+{
+  switch (stage) {
+    case Stage::Analysis:
+      return "analysis";
+    case Stage::Index:
+      return "index";
+    case Stage::Rewrite:
+      return "rewrite";
+    case Stage::Correct:
+      return "correct";
+    case Stage::Write:
+      return "write";
+    case Stage::Copy:
+      return "copy";
+  }
+  return "unknown";
+}
+
+uint64_t elapsedNanoseconds(std::chrono::steady_clock::time_point start) 
+  noexcept
+{
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+FileStats::FileStats() noexcept:
+  m_times{},
+  m_outcome{"failed"},
+  m_inBytes{0},
+  m_outBytes{0},
+  m_envelopeCount{0}
+{
+}
+
+void FileStats::addTime(Stage stage, uint64_t time) noexcept
+{
+  m_times[static_cast<size_t>(stage)].fetch_add(time, 
+      std::memory_order_relaxed);
+}
+
+uint64_t FileStats::time(Stage stage) const noexcept
+{
+  return m_times[static_cast<size_t>(stage)].load(std::memory_order_relaxed);
+}
+
+// Found in the destination, and left as it is.
+void FileStats::setSkipped() noexcept
+{
+  m_outcome = "skipped";
+}
+
+void FileStats::setCopied(uint64_t size) noexcept
+{
+  m_outcome = "copied";
+  m_inBytes = size;
+  m_outBytes = size;
+}
+
+// The number of Envelopes is the number given to the transformer.
+void FileStats::setRewritten(uint64_t inBytes, uint64_t outBytes, 
+    uint64_t envelopeCount) noexcept
+{
+  m_outcome = "rewritten";
+  m_inBytes = inBytes;
+  m_outBytes = outBytes;
+  m_envelopeCount = envelopeCount;
+}
+
+char const *FileStats::outcome() const noexcept
+{
+  return m_outcome;
+}
+
+uint64_t FileStats::inBytes() const noexcept
+{
+  return m_inBytes;
+}
+
+uint64_t FileStats::outBytes() const noexcept
+{
+  return m_outBytes;
+}
+
+uint64_t FileStats::envelopeCount() const noexcept
+{
+  return m_envelopeCount;
+}
+
+StageTimer::StageTimer(FileStats *stats, Stage stage) noexcept:
+  m_stats{stats},
+  m_stage{stage},
+  m_start{stats != nullptr ? std::chrono::steady_clock::now() 
+    : std::chrono::steady_clock::time_point{}}
+{
+}
+
+StageTimer::~StageTimer()
+{
+  stop();
+}
+
+void StageTimer::stop() noexcept
+{
+  if (m_stats != nullptr) {
+    m_stats->addTime(m_stage, elapsedNanoseconds(m_start));
+    m_stats = nullptr;
+  }
+}
+
+StatsReport::StatsReport() noexcept:
+  m_mutex{},
+  m_records{}
+{
+}
+
+void StatsReport::add(std::string const &filename, bool isOk, 
+    uint64_t totalTime, FileStats const &stats)
+{
+  Record r{filename, isOk, isOk ? stats.outcome() : "failed", 
+    stats.inBytes(), stats.outBytes(), stats.envelopeCount(), totalTime, {}};
+  for (Stage const stage : STAGES) {
+    r.times[static_cast<size_t>(stage)] = stats.time(stage);
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_records.push_back(r);
+}
+
+// Writes the stats of each recording, in the order they were finished,
+// followed by the sums over the run and the time the run took.
+bool StatsReport::write(std::string const &filename, uint64_t wallTime) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::ofstream out(filename, std::ios::trunc);
+
+  Record sum{"", true, "", 0, 0, 0, 0, {}};
+  uint64_t failedCount{0};
+  out << "{\n  \"files\": [";
+  for (size_t i{0}; i < m_records.size(); i++) {
+    Record const &r{m_records[i]};
+    out << (i > 0 ? ",\n" : "\n") << "    {\n      \"file\": ";
+    writeString(out, r.filename);
+    out << ",\n      \"outcome\": \"" << r.outcome << "\",\n";
+    writeCounts(out, "      ", r.inBytes, r.outBytes, r.envelopeCount, 
+        "total", r.totalTime, r.times);
+    out << "    }";
+
+    sum.inBytes += r.inBytes;
+    sum.outBytes += r.outBytes;
+    sum.envelopeCount += r.envelopeCount;
+    sum.totalTime += r.totalTime;
+    for (size_t j{0}; j < STAGE_COUNT; j++) {
+      sum.times[j] += r.times[j];
+    }
+    if (!r.isOk) {
+      failedCount++;
+    }
+  }
+  out << "\n  ],\n  \"run\": {\n    \"files\": " << m_records.size() 
+    << ",\n    \"failed\": " << failedCount << ",\n    ";
+  writeSeconds(out, "wallSeconds", wallTime);
+  out << ",\n";
+  writeCounts(out, "    ", sum.inBytes, sum.outBytes, sum.envelopeCount, 
+      "total", sum.totalTime, sum.times);
+  out << "  }\n}\n";
+  out.close();
+  return out.good();
+}
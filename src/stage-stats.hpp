@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STAGE_STATS_HPP
+#define STAGE_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// The stages of processing a recording that are timed. Rewrite is the
+// whole of reading, transforming, and writing the frames of a recording
+// that is rewritten, of which Correct and Write are the time spent 
+// correcting batched floats and writing the output.
+enum class Stage {
+  Analysis,
+  Index,
+  Rewrite,
+  Correct,
+  Write,
+  Copy
+};
+constexpr size_t STAGE_COUNT{6};
+
+char const *stageName(Stage) noexcept;
+
+// What processing one recording took and did. The stages are timed on the
+// threads they run on, so stages running concurrently add up to more than
+// the time taken.
+class FileStats {
+ public:
+  FileStats() noexcept;
+  ~FileStats() = default;
+
+ private:
+  FileStats(FileStats const &) = delete;
+  FileStats(FileStats &&) = delete;
+  FileStats &operator=(FileStats const &) = delete;
+  FileStats &operator=(FileStats &&) = delete;
+
+ public:
+  void addTime(Stage, uint64_t) noexcept;
+  uint64_t time(Stage) const noexcept;
+  void setSkipped() noexcept;
+  void setCopied(uint64_t) noexcept;
+  void setRewritten(uint64_t, uint64_t, uint64_t) noexcept;
+  char const *outcome() const noexcept;
+  uint64_t inBytes() const noexcept;
+  uint64_t outBytes() const noexcept;
+  uint64_t envelopeCount() const noexcept;
+
+ private:
+  std::array<std::atomic<uint64_t>, STAGE_COUNT> m_times;
+  char const *m_outcome;
+  uint64_t m_inBytes;
+  uint64_t m_outBytes;
+  uint64_t m_envelopeCount;
+};
+
+// Adds the time from construction to destruction, or to when stopped, to
+// a stage, if there are stats to add to.
+class StageTimer {
+ public:
+  StageTimer(FileStats *, Stage) noexcept;
+  ~StageTimer();
+
+ private:
+  StageTimer(StageTimer const &) = delete;
+  StageTimer(StageTimer &&) = delete;
+  StageTimer &operator=(StageTimer const &) = delete;
+  StageTimer &operator=(StageTimer &&) = delete;
+
+ public:
+  void stop() noexcept;
+
+ private:
+  FileStats *m_stats;
+  Stage const m_stage;
+  std::chrono::steady_clock::time_point const m_start;
+};
+
+// The stats of all recordings of a run, written as JSON once the run is
+// done, per recording and added up over the run. Shared between all 
+// workers.
+class StatsReport {
+ private:
+  struct Record {
+    std::string filename;
+    bool isOk;
+    char const *outcome;
+    uint64_t inBytes;
+    uint64_t outBytes;
+    uint64_t envelopeCount;
+    uint64_t totalTime;
+    std::array<uint64_t, STAGE_COUNT> times;
+  };
+
+ public:
+  StatsReport() noexcept;
+  ~StatsReport() = default;
+
+ private:
+  StatsReport(StatsReport const &) = delete;
+  StatsReport(StatsReport &&) = delete;
+  StatsReport &operator=(StatsReport const &) = delete;
+  StatsReport &operator=(StatsReport &&) = delete;
+
+ public:
+  void add(std::string const &, bool, uint64_t, FileStats const &);
+  bool write(std::string const &, uint64_t) const;
+
+ private:
+  mutable std::mutex m_mutex;
+  std::vector<Record> m_records;
+};
+
+uint64_t elapsedNanoseconds(std::chrono::steady_clock::time_point) noexcept;
+
+#endif
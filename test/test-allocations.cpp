@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2020  Christian Berger, Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "opendlv-standard-message-set.hpp"
+
+#include "classifier.hpp"
+#include "correction-rules.hpp"
+#include "envelope-encoder.hpp"
+#include "envelope-transformer.hpp"
+#include "output-sink.hpp"
+#include "rec-file-view.hpp"
+#include "rec-index.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+// Checks that the Envelopes of a recording are decoded, corrected and
+// encoded again without any heap allocations per Envelope, by counting the
+// allocations while recordings of N and 2N Envelopes are processed. The
+// counts must be the same, since only buffers that are reused for all
+// Envelopes may be allocated.
+
+namespace {
+
+uint64_t allocationCount{0};
+
+}
+
+// The replaced operators allocate with malloc, which GCC does not know when
+// it inlines them.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(std::size_t size)
+{
+  allocationCount++;
+  void *p{std::malloc(size == 0 ? 1 : size)};
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+#pragma GCC diagnostic pop
+
+namespace {
+
+// A recording of readings of all handled types, and of a type without
+// rules. Some readings lack a float field, so that they are decoded and
+// encoded again rather than corrected in place, and some repeat the one
+// before, so that they are removed as duplicates.
+std::string generateRecording(uint32_t envelopeCount)
+{
+  int32_t const dataTypes[]{opendlv::proxy::AccelerationReading::ID(), 
+    opendlv::proxy::MagneticFieldReading::ID(), 
+    opendlv::proxy::AngularVelocityReading::ID(), 
+    opendlv::proxy::AltitudeReading::ID(), 
+    opendlv::proxy::GroundSpeedReading::ID(), 
+    opendlv::proxy::GeodeticHeadingReading::ID(), 
+    opendlv::proxy::SwitchStateReading::ID(), 
+    opendlv::proxy::PedalPositionRequest::ID()};
+  uint32_t const dataTypeCount{sizeof(dataTypes) / sizeof(dataTypes[0])};
+
+  std::string recording;
+  uint32_t seed{1};
+  for (uint32_t i{0}; i < envelopeCount; i++) {
+    EnvelopeFields fields;
+    fields.dataType = dataTypes[i % dataTypeCount];
+    fields.sampleTimeStamp.seconds(static_cast<int32_t>(1000 + i / 100));
+    fields.sampleTimeStamp.microseconds(static_cast<int32_t>(i % 100));
+    fields.sent = fields.sampleTimeStamp;
+    fields.received = fields.sampleTimeStamp;
+    fields.senderStamp = i % 3;
+
+    float floats[3];
+    for (float &f : floats) {
+      if (i % 7 != 0) {
+        seed = seed * 1103515245 + 12345;
+      }
+      f = static_cast<float>(seed % 4000) - 2000.0f;
+    }
+    uint32_t const floatCount{(i % 11 == 0) ? 2u : 3u};
+    appendReadingFrame(recording, fields, floats, floatCount, nullptr, 0);
+  }
+  return recording;
+}
+
+// Returns the number of allocations made while the recording is classified
+// and transformed.
+uint64_t countAllocations(std::string const &recording)
+{
+  Classification const classification{true, true, true, false};
+  CorrectionRules const rules{defaultCorrectionRules()};
+  EnvelopeTransformer transformer(classification, rules);
+  RecIndexWriter indexWriter("/dev/null");
+  EnvelopeTransformer::Indexer const indexer{
+    [&indexWriter](IndexEntry const &entry) { indexWriter.add(entry); }};
+  transformer.setIndexer(indexer);
+  OutputSink sink("/dev/null", 1024 * 1024, false);
+  EnvelopeTransformer::BatchConsumer const writeBatch{
+    [&transformer, &sink](EnvelopeTransformer::Batch &batch) {
+      transformer.writeBatch(batch, sink);
+    }};
+  Classifier classifier;
+
+  uint64_t const before{allocationCount};
+  uint64_t frameCount{0};
+  EnvelopeSpan span;
+  uint64_t pos{0};
+  while (decodeFrame(recording.data(), recording.size(), pos, span)) {
+    frameCount++;
+    std::string_view const frame{recording.data() + span.offset, 
+      span.length};
+    classifier.add(span.dataType, frame.substr(span.serializedDataOffset, 
+          span.serializedDataLength));
+    transformer.push(frame, span, writeBatch);
+    pos += span.length;
+  }
+  transformer.flush(writeBatch);
+  uint64_t const after{allocationCount};
+
+  if (frameCount == 0 || transformer.envelopeCount() != frameCount) {
+    std::cerr << "Not all Envelopes were transformed." << std::endl;
+    std::exit(1);
+  }
+  return after - before;
+}
+
+}
+
+int32_t main()
+{
+  uint32_t const envelopeCount{20000};
+  uint64_t const single{countAllocations(generateRecording(envelopeCount))};
+  uint64_t const twice{countAllocations(generateRecording(2 
+        * envelopeCount))};
+  std::cout << envelopeCount << " Envelopes: " << single 
+    << " allocations, " << 2 * envelopeCount << " Envelopes: " << twice 
+    << " allocations." << std::endl;
+  return (single == twice) ? 0 : 1;
+}